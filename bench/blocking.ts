@@ -0,0 +1,48 @@
+// Throughput of sequential point reads in a worker thread, using promises
+// (await tn.get()) and the blocking API (tn.getBlocking()).
+
+import {Worker, isMainThread, workerData, parentPort} from 'worker_threads'
+import {openDb} from './util'
+
+const keys = 1000
+const reads = 100000
+
+if (isMainThread) {
+  ;(async () => {
+    const db = openDb()
+    await db.doTn(async tn => {
+      for (let i = 0; i < keys; i++) tn.set(`k${i}`, 'hi there')
+    })
+
+    for (const mode of ['promise', 'blocking', 'promise', 'blocking']) {
+      const result = await new Promise<number>((resolve, reject) => {
+        const w = new Worker(`require('ts-node/register'); require(${JSON.stringify(__filename)})`,
+          {eval: true, workerData: {mode}})
+        w.on('message', resolve)
+        w.on('error', reject)
+      })
+      console.log(`${reads} sequential gets in a worker, ${mode}`.padEnd(50),
+        `${(reads / result * 1000).toFixed(0).padStart(8)} reads/s`)
+    }
+
+    await db.clearRangeStartsWith('')
+    db.close()
+  })()
+} else {
+  ;(async () => {
+    const db = openDb()
+    const start = Date.now()
+    if (workerData.mode === 'blocking') {
+      db.doTnBlocking(tn => {
+        for (let i = 0; i < reads; i++) tn.snapshot().getBlocking(`k${i % keys}`)
+      })
+    } else {
+      await db.doTn(async tn => {
+        for (let i = 0; i < reads; i++) await tn.snapshot().get(`k${i % keys}`)
+      })
+    }
+    const ms = Date.now() - start
+    db.close()
+    parentPort!.postMessage(ms)
+  })()
+}
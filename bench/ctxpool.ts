@@ -0,0 +1,26 @@
+// Runs 1M get() calls and reports throughput along with the native context
+// pool usage. To compare against plain malloc / free, rebuild the native
+// module with the pool disabled and run this again:
+//
+//   CXXFLAGS=-DFDB_NODE_NO_CTX_POOL npx node-gyp rebuild
+
+import * as fdb from '../lib'
+import {openDb, bench} from './util'
+
+const total = 1000000
+const perTxn = 50000 // Stay well inside the 5 second transaction limit.
+
+;(async () => {
+  const db = openDb()
+  await db.set('k', 'hi there')
+
+  let elapsed = 0
+  for (let done = 0; done < total; done += perTxn) {
+    elapsed += await db.doTn(tn => bench(`get x${perTxn}`, perTxn, () => tn.snapshot().get('k'), 100))
+  }
+  console.log(`${total} gets in ${elapsed.toFixed(0)} ms (${(total / elapsed * 1000).toFixed(0)} ops/s)`)
+  console.log('context pools', fdb.getNativeStats().ctxPools)
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
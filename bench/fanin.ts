@@ -0,0 +1,24 @@
+// Throughput of many concurrent point reads, each through db.get() (one
+// transaction per read) or through a batched reader.
+
+import {openDb, bench} from './util'
+
+const keys = 1000
+
+;(async () => {
+  const db = openDb()
+  await db.doTn(async tn => {
+    for (let i = 0; i < keys; i++) tn.set(`k${i}`, 'hi there')
+  })
+
+  const reader = db.batchedReader()
+  for (let r = 0; r < 2; r++) {
+    await bench('db.get, 1000 concurrent', 100000, i => db.get(`k${i % keys}`), 1000)
+    await bench('batchedReader.get, 1000 concurrent', 100000, i => reader.get(`k${i % keys}`), 1000)
+  }
+  const {gets, batches} = reader.getStats()
+  console.log(`batched reader: ${(gets / batches).toFixed(1)} reads per transaction`)
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
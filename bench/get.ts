@@ -0,0 +1,30 @@
+// Compares copying and zero-copy reads of values from 16 bytes to 100kb.
+
+import * as fdb from '../lib'
+import {openDb, bench} from './util'
+
+const sizes = [16, 256, 1024, 4096, 16384, 100000]
+
+;(async () => {
+  const db = openDb()
+
+  await db.doTn(async tn => {
+    for (const size of sizes) tn.set('v' + size, Buffer.alloc(size, 'x'))
+  })
+
+  for (const size of sizes) {
+    const key = 'v' + size
+    const iterations = size >= 16384 ? 20000 : 100000
+
+    // Read inside one transaction so we measure the read path and not GRVs.
+    for (const zeroCopy of [false, true]) {
+      fdb.setZeroCopyThreshold(zeroCopy ? 1 : 0)
+      await db.doTn(tn => bench(`get ${size} bytes ${zeroCopy ? 'zero-copy' : 'copy'}`,
+        iterations, () => tn.snapshot().get(key), 100))
+    }
+  }
+
+  fdb.setZeroCopyThreshold(0)
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
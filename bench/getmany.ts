@@ -0,0 +1,25 @@
+// Compares loading a page of N keys with one get() per key against a single
+// getMany() call.
+
+import {openDb, bench} from './util'
+
+;(async () => {
+  const db = openDb()
+  const numKeys = 1000
+  await db.doTn(async tn => {
+    for (let i = 0; i < numKeys; i++) tn.set('k' + i, Buffer.alloc(100, 'x'))
+  })
+
+  for (const pageSize of [10, 100, 1000]) {
+    const keys = new Array(pageSize).fill(0).map((_, i) => 'k' + i)
+    const iterations = 1000000 / pageSize
+
+    await db.doTn(tn => bench(`get x${pageSize} via Promise.all`, iterations,
+      () => Promise.all(keys.map(k => tn.snapshot().get(k)))))
+    await db.doTn(tn => bench(`getMany x${pageSize}`, iterations,
+      () => tn.snapshot().getMany(keys)))
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
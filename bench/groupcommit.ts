@@ -0,0 +1,23 @@
+// Throughput of counter increments from many concurrent callers, each
+// committed in its own transaction with db.add() or through a group commit
+// writer.
+
+import {openDb, bench} from './util'
+
+const counters = 100
+const one = Buffer.from([1, 0, 0, 0, 0, 0, 0, 0])
+
+;(async () => {
+  const db = openDb()
+  const writer = db.groupCommitWriter()
+
+  for (let r = 0; r < 2; r++) {
+    await bench('db.add, 1000 concurrent', 50000, i => db.add(`c${i % counters}`, one), 1000)
+    await bench('groupCommitWriter.add, 1000 concurrent', 50000, i => writer.add(`c${i % counters}`, one), 1000)
+  }
+  const {writes, commits} = writer.getStats()
+  console.log(`group commit writer: ${(writes / commits).toFixed(1)} mutations per commit`)
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
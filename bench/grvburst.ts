@@ -0,0 +1,32 @@
+// Latency of bursts of transactions which all start at once, with and
+// without read version coalescing. Each burst starts burstSize transactions
+// in the same tick and waits for all of them to finish.
+
+import {openDb, percentiles} from './util'
+
+const bursts = 200
+const burstSize = 1000
+
+;(async () => {
+  const db = openDb()
+  await db.set('k', 'hi there')
+
+  for (const coalesce of [false, true, false, true]) {
+    db.setCoalesceReadVersions(coalesce)
+    const samples: number[] = []
+    for (let i = 0; i < bursts; i++) {
+      const start = process.hrtime.bigint()
+      await Promise.all(new Array(burstSize).fill(null).map(() => db.doTn(tn => tn.get('k'))))
+      samples.push(Number(process.hrtime.bigint() - start) / 1e3)
+    }
+    const {p50, p99} = percentiles(samples)
+    const stats = db.getReadVersionBatcherStats()
+    console.log(`${burstSize} tn burst${coalesce ? ', coalesced' : ''}`.padEnd(30),
+      `p50 ${p50.toFixed(0).padStart(7)} us  p99 ${p99.toFixed(0).padStart(7)} us`,
+      stats ? `  ${stats.saved} of ${stats.requests} GRVs saved` : '')
+  }
+
+  db.setCoalesceReadVersions(false)
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,39 @@
+// Compares writing N keys with one set() call each against packing them into
+// a MutationBatch and applying it with a single native call.
+
+import {openDb} from './util'
+
+const sizes = [5000, 20000, 50000]
+
+const time = (name: string, count: number, fn: () => void) => {
+  const start = process.hrtime.bigint()
+  fn()
+  const elapsedMs = Number(process.hrtime.bigint() - start) / 1e6
+  console.log(`${name.padEnd(40)} ${(count / elapsedMs * 1000).toFixed(0).padStart(10)} ops/s  ${(elapsedMs * 1000 / count).toFixed(2).padStart(8)} us/op`)
+}
+
+;(async () => {
+  const db = openDb()
+  const value = Buffer.alloc(100, 'v')
+
+  for (const count of sizes) {
+    // The writes are never committed - we only care about the cost of the calls.
+    for (let rep = 0; rep < 3; rep++) {
+      let tn = db.rawCreateTransaction()
+      time(`set() x${count}`, count, () => {
+        for (let i = 0; i < count; i++) tn.set('key' + i, value)
+      })
+      tn.rawCancel()
+
+      tn = db.rawCreateTransaction()
+      time(`applyMutations x${count}`, count, () => {
+        const batch = tn.mutationBatch()
+        for (let i = 0; i < count; i++) batch.set('key' + i, value)
+        tn.applyMutations(batch)
+      })
+      tn.rawCancel()
+    }
+  }
+
+  db.close()
+})()
@@ -0,0 +1,31 @@
+// Issues a large number of concurrent reads and reports how the native module
+// batched their completions.
+
+import * as fdb from '../lib'
+import {openDb, bench} from './util'
+
+const outstanding = +(process.argv[2] || 50000)
+
+;(async () => {
+  const db = openDb()
+  await db.set('k', 'hi there')
+
+  for (const batchSize of [1, 64, 1024]) {
+    fdb.setMaxCompletionBatch(batchSize)
+    const before = fdb.getNativeStats()
+
+    await db.doTn(tn => bench(`${outstanding} concurrent gets, batch ${batchSize}`,
+      outstanding, () => tn.snapshot().get('k'), outstanding))
+
+    const after = fdb.getNativeStats()
+    const completions = after.completions - before.completions
+    const batches = after.completionBatches - before.completionBatches
+    console.log(`  avg batch ${(completions / batches).toFixed(1)}, max batch ${after.maxCompletionBatch}, ` +
+      `avg dispatch latency ${((after.dispatchLatencyTotalUs - before.dispatchLatencyTotalUs) / completions).toFixed(1)} us`)
+    console.log(`  max queue depth ${after.maxQueueDepth}, ${after.backlogPushes - before.backlogPushes} backlogged pushes ` +
+      `over ${((after.backlogUs - before.backlogUs) / 1000).toFixed(1)} ms`)
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
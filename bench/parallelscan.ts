@@ -0,0 +1,47 @@
+// Throughput of a full scan of a range using a single getRange, and using
+// parallelScan at a few concurrency levels. Against a single local fdbserver
+// there's only one storage server, so expect the difference to be small -
+// this is mostly useful against a real cluster.
+
+import {openDb} from './util'
+
+const rows = 500000
+const valueBytes = 100
+
+;(async () => {
+  const db = openDb()
+  for (let i = 0; i < rows; i += 5000) {
+    await db.doTn(async tn => {
+      for (let j = i; j < i + 5000; j++) tn.set('k' + `${j}`.padStart(7, '0'), Buffer.alloc(valueBytes, j))
+    })
+  }
+
+  const report = (name: string, ms: number, count: number) => {
+    if (count !== rows) throw Error(`Read ${count} rows, expected ${rows}`)
+    console.log(name.padEnd(40), `${(rows / ms * 1000).toFixed(0).padStart(10)} rows/s`)
+  }
+
+  for (let round = 0; round < 2; round++) {
+    let start = Date.now()
+    let count = 0
+    // Big scans don't fit in one transaction, so carry on from the last key.
+    let cursor = 'k'
+    await db.doTn(async tn => {
+      for await (const batch of tn.snapshot().getRangeBatch(cursor + '\x00', 'l')) {
+        count += batch.length
+        cursor = batch[batch.length - 1][0].toString()
+      }
+    })
+    report('getRange', Date.now() - start, count)
+
+    for (const concurrency of [1, 4, 16]) {
+      start = Date.now()
+      count = 0
+      for await (const batch of db.parallelScan('k', 'l', {concurrency})) count += batch.length
+      report(`parallelScan, concurrency ${concurrency}`, Date.now() - start, count)
+    }
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,30 @@
+// Latency of a transaction body which reads 10 known keys with sequential
+// awaits, with and without prefetching them first.
+
+import {openDb, percentiles} from './util'
+
+const iterations = 5000
+const keys = new Array(10).fill(null).map((_, i) => `k${i}`)
+
+;(async () => {
+  const db = openDb()
+  await db.doTn(async tn => { for (const k of keys) tn.set(k, 'hi there') })
+
+  for (const prefetch of [false, true, false, true]) {
+    const samples: number[] = []
+    for (let i = 0; i < iterations; i++) {
+      const start = process.hrtime.bigint()
+      await db.doTn(async tn => {
+        if (prefetch) tn.prefetch(keys)
+        for (const k of keys) await tn.get(k)
+      })
+      samples.push(Number(process.hrtime.bigint() - start) / 1e3)
+    }
+    const {p50, p99} = percentiles(samples)
+    console.log(`${keys.length} sequential gets${prefetch ? ', prefetched' : ''}`.padEnd(40),
+      `p50 ${p50.toFixed(0).padStart(6)} us  p99 ${p99.toFixed(0).padStart(6)} us`)
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
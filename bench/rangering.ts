@@ -0,0 +1,69 @@
+// Throughput of a full range scan which sums every byte of every value. The
+// scan either runs on the main thread (packed getRange batches), or is copied
+// into a RangeRing and summed by a pool of worker threads.
+
+import {Worker, isMainThread, workerData, parentPort} from 'worker_threads'
+import {RangeRing} from '../lib'
+import {openDb} from './util'
+
+const rows = 200000
+const valueBytes = 200
+
+const sum = (buf: Buffer) => {
+  let total = 0
+  for (let i = 0; i < buf.length; i++) total += buf[i]
+  return total
+}
+
+if (isMainThread) {
+  ;(async () => {
+    const db = openDb()
+    for (let i = 0; i < rows; i += 1000) {
+      await db.doTn(async tn => {
+        for (let j = i; j < i + 1000; j++) tn.set('k' + `${j}`.padStart(7, '0'), Buffer.alloc(valueBytes, j))
+      })
+    }
+
+    const report = (name: string, ms: number) => {
+      console.log(name.padEnd(40), `${(rows / ms * 1000).toFixed(0).padStart(10)} rows/s`)
+    }
+
+    for (let round = 0; round < 2; round++) {
+      let start = Date.now()
+      let total = 0
+      await db.doTn(async tn => {
+        total = 0
+        for await (const batch of tn.snapshot().getRangeBatch('', '\xff', {packed: true})) {
+          for (let i = 0; i < batch.length; i++) total += sum(batch.rawValue(i))
+        }
+      })
+      report('getRange on the main thread', Date.now() - start)
+
+      for (const workers of [1, 2, 4]) {
+        const ring = new RangeRing(16 * 1024 * 1024)
+        start = Date.now()
+        const results = new Array(workers).fill(null).map(() => new Promise<number>((resolve, reject) => {
+          const w = new Worker(`require('ts-node/register'); require(${JSON.stringify(__filename)})`,
+            {eval: true, workerData: {buffer: ring.buffer}})
+          w.on('message', resolve)
+          w.on('error', reject)
+        }))
+        await db.scanIntoRing(ring, '', '\xff')
+        const ringTotal = (await Promise.all(results)).reduce((a, b) => a + b)
+        report(`ring with ${workers} worker${workers > 1 ? 's' : ''}`, Date.now() - start)
+        if (ringTotal !== total) throw Error('Ring scan returned different data')
+      }
+    }
+
+    await db.clearRangeStartsWith('')
+    db.close()
+  })()
+} else {
+  const ring = new RangeRing(workerData.buffer)
+  let total = 0
+  let batch
+  while ((batch = ring.read()) != null) {
+    for (let i = 0; i < batch.length; i++) total += sum(batch.rawValue(i))
+  }
+  parentPort!.postMessage(total)
+}
@@ -0,0 +1,30 @@
+// Latency of small read-only transactions. _exec skips the commit for
+// transactions which don't write. To compare against the old behaviour, the
+// second run commits explicitly inside the transaction body.
+
+import {openDb, percentiles} from './util'
+
+const iterations = 20000
+
+;(async () => {
+  const db = openDb()
+  await db.set('k', 'hi there')
+
+  for (const explicitCommit of [false, true, false, true]) {
+    const samples: number[] = []
+    for (let i = 0; i < iterations; i++) {
+      const start = process.hrtime.bigint()
+      await db.doTn(async tn => {
+        await tn.get('k')
+        if (explicitCommit) await tn.rawCommit()
+      })
+      samples.push(Number(process.hrtime.bigint() - start) / 1e3)
+    }
+    const {p50, p99} = percentiles(samples)
+    console.log(`read-only doTn ${explicitCommit ? 'with commit' : 'no commit'}`.padEnd(40),
+      `p50 ${p50.toFixed(0).padStart(6)} us  p99 ${p99.toFixed(0).padStart(6)} us`)
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,30 @@
+// Latency of small read-only transactions with and without the read version
+// cache. With the cache, most transactions skip the GRV round trip.
+
+import {openDb, percentiles} from './util'
+
+const iterations = 20000
+
+;(async () => {
+  const db = openDb()
+  await db.set('k', 'hi there')
+
+  for (const staleness of [0, 100, 0, 100]) {
+    db.setMaxReadVersionStaleness(staleness)
+    const samples: number[] = []
+    for (let i = 0; i < iterations; i++) {
+      const start = process.hrtime.bigint()
+      await db.doTn(async tn => { await tn.get('k') })
+      samples.push(Number(process.hrtime.bigint() - start) / 1e3)
+    }
+    const {p50, p99} = percentiles(samples)
+    const stats = db.getReadVersionCacheStats()
+    console.log(`max staleness ${staleness} ms`.padEnd(30),
+      `p50 ${p50.toFixed(0).padStart(6)} us  p99 ${p99.toFixed(0).padStart(6)} us`,
+      stats ? `  hit rate ${(stats.hitRate * 100).toFixed(1)}%` : '')
+  }
+
+  db.setMaxReadVersionStaleness(0)
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,41 @@
+// Latency of a transaction body making sequential reads, on its first
+// attempt and on a retry. The first attempt is failed artificially once its
+// reads are done. The retry has its reads prefetched, so its sequential
+// gets should mostly hit the read cache.
+
+import {openDb, percentiles} from './util'
+import {FDBError} from '../lib'
+
+const iterations = 2000
+const reads = 10
+
+;(async () => {
+  const db = openDb()
+  await db.doTn(async tn => {
+    for (let i = 0; i < reads; i++) tn.set(`k${i}`, 'hi there')
+  })
+
+  const first: number[] = [], retry: number[] = []
+  for (let i = 0; i < iterations; i++) {
+    let attempt = 0
+    await db.doTn(async tn => {
+      attempt++
+      const start = process.hrtime.bigint()
+      for (let k = 0; k < reads; k++) await tn.get(`k${k}`)
+      const us = Number(process.hrtime.bigint() - start) / 1e3
+      if (attempt === 1) {
+        first.push(us)
+        throw new FDBError('not_committed', 1020)
+      } else retry.push(us)
+    })
+  }
+
+  for (const [name, samples] of [['first attempt', first], ['retry', retry]] as const) {
+    const {p50, p99} = percentiles(samples)
+    console.log(`${reads} sequential gets, ${name}`.padEnd(40),
+      `p50 ${p50.toFixed(0).padStart(6)} us  p99 ${p99.toFixed(0).padStart(6)} us`)
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
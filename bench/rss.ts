@@ -0,0 +1,47 @@
+// Memory use of a write-heavy loop. Each transaction writes ~1MB. With
+// 'gc', transactions are created with rawCreateTransaction and left for the
+// garbage collector to destroy, which is what doTn used to do. With
+// 'dispose', they're run through doTn, which destroys them as soon as they
+// finish. Run each mode in its own process so they don't share a heap:
+//
+//   npx ts-node bench/rss.ts gc
+//   npx ts-node bench/rss.ts dispose
+
+import {openDb} from './util'
+import {Transaction} from '../lib'
+
+const iterations = 2000
+const writesPerTn = 100
+const value = Buffer.alloc(10000, 'x')
+const mode = process.argv[2] === 'gc' ? 'gc' : 'dispose'
+
+const mb = (bytes: number) => (bytes / (1024 * 1024)).toFixed(0).padStart(6)
+
+;(async () => {
+  const db = openDb()
+  db.setTransactionPoolSize(0)
+
+  let peak = 0
+  const start = Date.now()
+  for (let i = 0; i < iterations; i++) {
+    const body = async (tn: Transaction<any, any, any, any>) => {
+      for (let k = 0; k < writesPerTn; k++) tn.set(`k${k}`, value)
+    }
+
+    if (mode === 'gc') {
+      const tn = db.rawCreateTransaction()
+      await body(tn)
+      await tn.rawCommit()
+    } else {
+      await db.doTn(body)
+    }
+
+    const {rss} = process.memoryUsage()
+    peak = Math.max(peak, rss)
+    if (i % 200 === 0) console.log(`${mode} ${String(i).padStart(5)} tns  rss ${mb(rss)} MB`)
+  }
+  console.log(`${mode} peak rss ${mb(peak)} MB in ${Date.now() - start} ms`)
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,32 @@
+// Read-your-writes heavy transactions: each one writes some keys and then
+// reads them back. Those reads are answered from the transaction's cache, so
+// their futures are ready as soon as they're created. Compares awaiting
+// get() (one promise and microtask hop per read) with getMaybeSync().
+
+import {openDb, bench} from './util'
+import {getNativeStats} from '../lib'
+
+const keys = 100
+
+;(async () => {
+  const db = openDb()
+
+  const fastBefore = getNativeStats().readyFastPath
+  for (let r = 0; r < 2; r++) {
+    await bench(`write ${keys}, await get() x${keys}`, 2000, () => db.doTn(async tn => {
+      for (let i = 0; i < keys; i++) tn.set(`k${i}`, 'hi there')
+      for (let i = 0; i < keys; i++) await tn.get(`k${i}`)
+    }))
+    await bench(`write ${keys}, getMaybeSync() x${keys}`, 2000, () => db.doTn(async tn => {
+      for (let i = 0; i < keys; i++) tn.set(`k${i}`, 'hi there')
+      for (let i = 0; i < keys; i++) {
+        const v = tn.getMaybeSync(`k${i}`)
+        if (v instanceof Promise) await v
+      }
+    }))
+  }
+  console.log(`${getNativeStats().readyFastPath - fastBefore} promises resolved on the ready fast path`)
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,35 @@
+// Scans a 100k row range with and without read-ahead. Each batch is followed
+// by a little simulated work, which read-ahead should overlap with fetching
+// the next batches.
+
+import {openDb} from './util'
+
+const numRows = 100000
+
+;(async () => {
+  const db = openDb()
+  for (let i = 0; i < numRows; i += 10000) {
+    await db.doTn(async tn => {
+      for (let k = i; k < i + 10000; k++) tn.set('row' + k.toString().padStart(8, '0'), Buffer.alloc(100, 'x'))
+    })
+  }
+
+  for (const workMs of [0, 1]) {
+    for (const readAhead of [0, 1, 4, 16]) {
+      const start = process.hrtime.bigint()
+      let rows = 0
+      await db.doTn(async tn => {
+        rows = 0
+        for await (const batch of tn.getRangeBatch('row', 'rox', {readAhead, packed: true})) {
+          rows += batch.length
+          if (workMs) await new Promise(resolve => setTimeout(resolve, workMs))
+        }
+      })
+      const elapsedMs = Number(process.hrtime.bigint() - start) / 1e6
+      console.log(`scan ${rows} rows, ${workMs}ms work per batch, readAhead ${readAhead}`.padEnd(55), `${elapsedMs.toFixed(1).padStart(8)} ms`)
+    }
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,57 @@
+// How evenly a skewed range is split into 10 chunks, by key count and by
+// planRangeSplits. The first 10% of keys hold most of the data. Prints the
+// actual size of the biggest and smallest chunk for each approach.
+
+import {openDb} from './util'
+
+const rows = 20000
+const chunks = 10
+
+const key = (i: number) => 'k' + `${i}`.padStart(6, '0')
+const valueBytes = (i: number) => i < rows / 10 ? 20000 : 200
+
+;(async () => {
+  const db = openDb()
+  for (let i = 0; i < rows; i += 500) {
+    await db.doTn(async tn => {
+      for (let j = i; j < i + 500; j++) tn.set(key(j), Buffer.alloc(valueBytes(j)))
+    })
+  }
+
+  // Actual bytes in a raw range, read back from the database.
+  const root = db.getRoot()
+  const measure = async (begin: Buffer, end: Buffer) => {
+    let bytes = 0
+    let cursor = begin
+    await root.doTn(async tn => {
+      for await (const batch of tn.snapshot().getRangeBatch(cursor, end)) {
+        for (const [k, v] of batch) bytes += k.length + v.length
+        cursor = Buffer.concat([batch[batch.length - 1][0], Buffer.alloc(1)])
+      }
+    })
+    return bytes
+  }
+
+  const report = async (name: string, ranges: [Buffer, Buffer][]) => {
+    const sizes = await Promise.all(ranges.map(([b, e]) => measure(b, e)))
+    const max = Math.max(...sizes), min = Math.min(...sizes)
+    console.log(name.padEnd(30), `${ranges.length} chunks`.padStart(10),
+      `max ${(max / 1e6).toFixed(2)}MB  min ${(min / 1e6).toFixed(2)}MB  max/min ${(max / Math.max(min, 1)).toFixed(1)}`)
+  }
+
+  const raw = (k: string) => Buffer.concat([db.getPrefix(), Buffer.from(k)])
+  const byCount: [Buffer, Buffer][] = []
+  for (let i = 0; i < chunks; i++) {
+    byCount.push([raw(key(i * rows / chunks)), raw(i === chunks - 1 ? 'l' : key((i + 1) * rows / chunks))])
+  }
+  await report('split by key count', byCount)
+
+  const total = await db.getEstimatedRangeSizeBytes('k')
+  const start = Date.now()
+  const splits = await db.planRangeSplits('k', undefined, {chunkBytes: Math.ceil(total / chunks)})
+  console.log(`planned in ${Date.now() - start}ms`)
+  await report('planRangeSplits', splits.map(s => [s.begin, s.end] as [Buffer, Buffer]))
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,31 @@
+// Throughput of string keyed set(k, v) and get(k) calls. String keys and
+// values are converted to bytes in native code, so this mostly measures that
+// path.
+
+import {openDb, bench, prefix} from './util'
+
+;(async () => {
+  // Use the root database so keys reach the native module as strings. (A
+  // prefixed subspace would concatenate them into buffers in JS first.)
+  const db = openDb().getRoot()
+  const perTxn = 10000
+
+  for (const valueSize of [8, 100, 1000, 5000]) {
+    const value = 'v'.repeat(valueSize)
+    // The writes are never committed - we only care about the cost of the calls.
+    const tn = db.rawCreateTransaction()
+    await bench(`set string key, ${valueSize} byte string value`, perTxn, async i => {
+      tn.set(prefix + 'key ' + i, value)
+    })
+    tn.rawCancel()
+  }
+
+  // Non-ascii keys take the same path, but produce more bytes than characters.
+  for (const keyBase of ['key ', 'clé ', '键 ']) {
+    await db.doTn(tn => bench(`get string key '${keyBase}'`, perTxn, i => (
+      tn.snapshot().get(prefix + keyBase + i)
+    ), 100))
+  }
+
+  db.close()
+})()
@@ -0,0 +1,30 @@
+// Throughput of small transactions run through doTn, with and without
+// reusing native transactions from the database's transaction pool.
+
+import {openDb} from './util'
+
+const iterations = 20000
+const concurrency = 32
+
+;(async () => {
+  const db = openDb()
+  await db.set('k', 'hi there')
+
+  for (const poolSize of [0, 32, 0, 32]) {
+    db.setTransactionPoolSize(poolSize)
+    let next = 0
+    const start = process.hrtime.bigint()
+    await Promise.all(new Array(concurrency).fill(null).map(async () => {
+      while (next++ < iterations) {
+        await db.doTn(async tn => { await tn.get('k') })
+      }
+    }))
+    const secs = Number(process.hrtime.bigint() - start) / 1e9
+    const {reused, created} = db.getTransactionPoolStats()
+    console.log(`pool size ${poolSize}`.padEnd(20),
+      `${(iterations / secs).toFixed(0).padStart(8)} tn/s  (reused ${reused}, created ${created})`)
+  }
+
+  await db.clearRangeStartsWith('')
+  db.close()
+})()
@@ -0,0 +1,41 @@
+// Shared helpers for the microbenchmarks in this directory. These aren't part
+// of the distribution - they're here to measure the effect of changes to the
+// native module. Run them against a local fdbserver with eg:
+//
+//   npx ts-node bench/get.ts
+//
+// All benchmarks write their data under the prefix below and clean it up
+// when they finish.
+
+import * as fdb from '../lib'
+
+export const prefix = '__bench_data__/'
+
+export const openDb = () => {
+  fdb.setAPIVersion(630)
+  return fdb.open().at(prefix)
+}
+
+// Run fn() repeatedly for (roughly) the specified number of iterations and
+// print the throughput. fn is called with the iteration number.
+export const bench = async (name: string, iterations: number, fn: (i: number) => Promise<any>, concurrency: number = 1) => {
+  // Warm up.
+  for (let i = 0; i < Math.min(iterations / 10, 1000); i++) await fn(i)
+
+  const start = process.hrtime.bigint()
+  let next = 0
+  await Promise.all(new Array(concurrency).fill(0).map(async () => {
+    while (next < iterations) await fn(next++)
+  }))
+  const elapsedMs = Number(process.hrtime.bigint() - start) / 1e6
+
+  console.log(`${name.padEnd(40)} ${(iterations / elapsedMs * 1000).toFixed(0).padStart(10)} ops/s  ${(elapsedMs * 1000 / iterations).toFixed(2).padStart(8)} us/op`)
+  return elapsedMs
+}
+
+// Returns the p50 and p99 of a list of latency samples.
+export const percentiles = (samples: number[]) => {
+  const sorted = samples.slice().sort((a, b) => a - b)
+  const at = (p: number) => sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))]
+  return {p50: at(0.5), p99: at(0.99)}
+}
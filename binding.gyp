@@ -12,6 +12,8 @@
         'src/utils.cpp'
       ],
       'cflags': ['-std=c++0x'],
+      # napi_set_instance_data needs N-API v6.
+      'defines': ['NAPI_VERSION=6'],
       'conditions': [
         ['OS=="linux"', {
           'link_settings': { 'libraries': ['-lfdb_c'] },
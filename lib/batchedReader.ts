@@ -0,0 +1,88 @@
+// Collects point reads from many callers into shared snapshot transactions.
+//
+// Every get() made in the same tick (or within maxWaitMs of the first one)
+// is read with a single getMany() call in one transaction, saving a
+// transaction and a GRV per read. Create one with db.batchedReader().
+
+import Database from './database'
+
+export type BatchedReaderOptions = {
+  /** Flush once this many reads are waiting. Defaults to 1000. */
+  maxBatchSize?: number,
+  /**
+   * How long to wait for more reads after the first one in a batch. By
+   * default (0) the batch is flushed at the end of the current tick.
+   */
+  maxWaitMs?: number,
+}
+
+export type BatchedReaderStats = {
+  gets: number,
+  /** Transactions run. Each one reads a batch. */
+  batches: number,
+}
+
+type PendingRead<ValOut> = {
+  resolve: (val: ValOut | undefined) => void,
+  reject: (err: any) => void,
+}
+
+export default class BatchedReader<KeyIn, ValOut> {
+  private _db: Database<KeyIn, any, any, ValOut>
+  private _maxBatchSize: number
+  private _maxWaitMs: number
+
+  private _keys: KeyIn[] = []
+  private _reads: PendingRead<ValOut>[] = []
+  private _timer: NodeJS.Timeout | null = null
+  private _scheduled = false
+
+  private _gets = 0
+  private _batches = 0
+
+  constructor(db: Database<KeyIn, any, any, ValOut>, opts: BatchedReaderOptions = {}) {
+    this._db = db
+    this._maxBatchSize = opts.maxBatchSize || 1000
+    this._maxWaitMs = opts.maxWaitMs || 0
+  }
+
+  /** Read key at a snapshot read version. */
+  get(key: KeyIn): Promise<ValOut | undefined> {
+    this._gets++
+    const promise = new Promise<ValOut | undefined>((resolve, reject) => {
+      this._keys.push(key)
+      this._reads.push({resolve, reject})
+    })
+
+    if (this._keys.length >= this._maxBatchSize) this.flush()
+    else if (!this._scheduled) {
+      this._scheduled = true
+      if (this._maxWaitMs > 0) this._timer = setTimeout(() => this.flush(), this._maxWaitMs)
+      else process.nextTick(() => this.flush())
+    }
+    return promise
+  }
+
+  /** Send any waiting reads now. */
+  flush() {
+    if (this._timer) clearTimeout(this._timer)
+    this._timer = null
+    this._scheduled = false
+    if (this._keys.length === 0) return
+
+    const keys = this._keys, reads = this._reads
+    this._keys = []
+    this._reads = []
+    this._batches++
+
+    this._db.doTn(tn => tn.snapshot().getMany(keys)).then(vals => {
+      for (let i = 0; i < reads.length; i++) reads[i].resolve(vals[i])
+    }, err => {
+      for (const r of reads) r.reject(err)
+    })
+  }
+
+  getStats(): BatchedReaderStats {
+    return {gets: this._gets, batches: this._batches}
+  }
+}
@@ -2,9 +2,19 @@ import * as fdb from './native'
 import Transaction, { RangeOptions, Watch } from './transaction'
 import {Transformer, defaultTransformer} from './transformer'
 import {NativeValue} from './native'
-import {KeySelector} from './keySelector'
+import keySelector, {KeySelector} from './keySelector'
+import MutationBatch from './mutationBatch'
+import TransactionPool, {TransactionPoolStats} from './transactionPool'
+import ReadVersionCache, {ReadVersionCacheStats, pickGrvOptions} from './readVersionCache'
+import ReadVersionBatcher, {ReadVersionBatcherStats} from './readVersionBatcher'
+import BatchedReader, {BatchedReaderOptions} from './batchedReader'
+import GroupCommitWriter, {GroupCommitWriterOptions} from './groupCommitWriter'
+import RangeRing, {RangeRingOptions} from './rangeRing'
+import parallelScan, {ParallelScanOptions} from './parallelScan'
+import planRangeSplits, {RangeSplit, RangeSplitOptions} from './splitPlanner'
 import Subspace, { root, GetSubspace, isGetSubspace } from './subspace'
 import {eachOption} from './opts'
+import {asBuf} from './util'
 import {DatabaseOptions,
   TransactionOptions,
   databaseOptionData,
@@ -13,6 +23,16 @@ import {DatabaseOptions,
 
 export type WatchWithValue<Value> = Watch & { value: Value | undefined }
 
+const DEFAULT_TRANSACTION_POOL_SIZE = 32
+
+// State shared by every Database object wrapping the same native database.
+type SharedState = {
+  pool: TransactionPool,
+  readVersionCache: ReadVersionCache | null,
+  readVersionBatcher: ReadVersionBatcher | null,
+}
+const sharedState = new WeakMap<fdb.NativeDatabase, SharedState>()
+
 export default class Database<KeyIn = NativeValue, KeyOut = Buffer, ValIn = NativeValue, ValOut = Buffer> {
   _db: fdb.NativeDatabase
   subspace: Subspace<KeyIn, KeyOut, ValIn, ValOut>
@@ -27,9 +47,91 @@ export default class Database<KeyIn = NativeValue, KeyOut = Buffer, ValIn = Nati
   }
 
   close() {
+    const shared = sharedState.get(this._db)
+    if (shared) {
+      shared.pool.clear()
+      sharedState.delete(this._db)
+    }
     this._db.close()
   }
 
+  private _shared(): SharedState {
+    let shared = sharedState.get(this._db)
+    if (shared == null) {
+      shared = {
+        pool: new TransactionPool(DEFAULT_TRANSACTION_POOL_SIZE),
+        readVersionCache: null,
+        readVersionBatcher: null,
+      }
+      sharedState.set(this._db, shared)
+    }
+    return shared
+  }
+
+  private _pool(): TransactionPool {
+    return this._shared().pool
+  }
+
+  /**
+   * Set the maximum number of finished transactions kept for reuse by
+   * `doTn()`. 0 disables reuse. This is shared by every scoped reference to
+   * the database. Defaults to 32.
+   */
+  setTransactionPoolSize(size: number) {
+    this._pool().setMaxSize(size)
+  }
+
+  getTransactionPoolStats(): TransactionPoolStats {
+    return this._pool().getStats()
+  }
+
+  /**
+   * Let transactions started with `doTn()` read at a cached read version
+   * which may be up to `ms` milliseconds old, instead of fetching a new read
+   * version from the cluster. This saves a network round trip per
+   * transaction, but transactions may not see writes committed in the last
+   * `ms` milliseconds - including your own. Transactions which write are
+   * also more likely to conflict. Retries always use a fresh read version.
+   *
+   * This is shared by every scoped reference to the database. Pass 0 to
+   * disable the cache (the default).
+   */
+  setMaxReadVersionStaleness(ms: number) {
+    const shared = this._shared()
+    if (ms <= 0) shared.readVersionCache = null
+    else if (shared.readVersionCache) shared.readVersionCache.maxStaleness = ms
+    else shared.readVersionCache = new ReadVersionCache(ms)
+  }
+
+  getReadVersionCacheStats(): ReadVersionCacheStats | null {
+    const cache = this._shared().readVersionCache
+    return cache ? cache.getStats() : null
+  }
+
+  /**
+   * Make transactions started with `doTn()` in the same tick share a single
+   * read version request. This is useful when many transactions are started
+   * at once. The first attempt of each transaction waits until the end of
+   * the tick before it's issued. Retries fetch their own read version.
+   *
+   * Transactions are only batched with others setting the same priority,
+   * lock aware and throttling tag options.
+   *
+   * This is shared by every scoped reference to the database. While the read
+   * version cache is enabled, it's only used by transactions which can't use
+   * the cache.
+   */
+  setCoalesceReadVersions(enabled: boolean) {
+    const shared = this._shared()
+    if (!enabled) shared.readVersionBatcher = null
+    else if (shared.readVersionBatcher == null) shared.readVersionBatcher = new ReadVersionBatcher()
+  }
+
+  getReadVersionBatcherStats(): ReadVersionBatcherStats | null {
+    const batcher = this._shared().readVersionBatcher
+    return batcher ? batcher.getStats() : null
+  }
+
   // **** Scoping functions
   
   getRoot(): Database {
@@ -67,9 +169,34 @@ export default class Database<KeyIn = NativeValue, KeyOut = Buffer, ValIn = Nati
   }
 
   // This is the API you want to use for non-trivial transactions.
+  //
+  // The transaction is reset and reused (or disposed) once this resolves, so
+  // it must not be used after that.
   async doTn<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => Promise<T>, opts?: TransactionOptions): Promise<T> {
-    return this.rawCreateTransaction(opts)._exec(body)
+    const {pool, readVersionCache, readVersionBatcher} = this._shared()
+    // The first attempt fetches its read version inside the retry loop, so
+    // a retryable GRV error goes through onError like any other.
+    let readVersion: (() => fdb.Version | Promise<fdb.Version>) | undefined
+    if (readVersionCache && pickGrvOptions(opts) == null) {
+      readVersion = () => readVersionCache.get(this._db)
+    } else if (readVersionBatcher) {
+      readVersion = () => readVersionBatcher.get(this._db, opts)
+    }
+
+    const tn = new Transaction<KeyIn, KeyOut, ValIn, ValOut>(pool.take(this._db), false, this.subspace, opts)
+    return tn._exec(body, opts, pool, readVersion)
   }
+  /**
+   * Run a transaction synchronously. The body is passed a transaction, and
+   * can use its blocking methods (`getBlocking()`, `getRangeBlocking()`) and
+   * writes. It's committed and retried like `doTn()`, but all of this blocks
+   * the calling thread. Only allowed in worker threads.
+   */
+  doTnBlocking<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => T, opts?: TransactionOptions): T {
+    const tn = new Transaction<KeyIn, KeyOut, ValIn, ValOut>(this._db.createTransaction(), false, this.subspace, opts)
+    return tn._execBlocking(body)
+  }
+
   // Alias for db.doTn.
   async doTransaction<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => Promise<T>, opts?: TransactionOptions): Promise<T> {
     return this.doTn(body, opts)
@@ -93,6 +220,16 @@ export default class Database<KeyIn = NativeValue, KeyOut = Buffer, ValIn = Nati
   get(key: KeyIn): Promise<ValOut | undefined> {
     return this.doTransaction(tn => tn.snapshot().get(key))
   }
+  getMany(keys: KeyIn[]): Promise<(ValOut | undefined)[]> {
+    return this.doTransaction(tn => tn.snapshot().getMany(keys))
+  }
+  /**
+   * Create a reader which combines concurrent `get()` calls into shared
+   * snapshot transactions. Useful when lots of callers each read one key.
+   */
+  batchedReader(opts?: BatchedReaderOptions): BatchedReader<KeyIn, ValOut> {
+    return new BatchedReader(this, opts)
+  }
   getKey(selector: KeyIn | KeySelector<KeyIn>): Promise<KeyOut | undefined> {
     return this.doTransaction(tn => tn.snapshot().getKey(selector))
   }
@@ -116,6 +253,23 @@ export default class Database<KeyIn = NativeValue, KeyOut = Buffer, ValIn = Nati
     return this.doOneshot(tn => tn.clearRangeStartsWith(prefix))
   }
 
+  mutationBatch(): MutationBatch<KeyIn, ValIn> {
+    return new MutationBatch(this.subspace)
+  }
+
+  applyMutations(batch: MutationBatch<any, any> | Buffer) {
+    return this.doOneshot(tn => tn.applyMutations(batch))
+  }
+
+  /**
+   * Create a writer which commits blind writes (set, clear and atomic ops)
+   * from many callers together in shared transactions, instead of one
+   * transaction per write.
+   */
+  groupCommitWriter(opts?: GroupCommitWriterOptions): GroupCommitWriter<KeyIn, ValIn> {
+    return new GroupCommitWriter(this, opts)
+  }
+
   getAndWatch(key: KeyIn): Promise<WatchWithValue<ValOut>> {
     return this.doTransaction(async tn => {
       const value = await tn.get(key)
@@ -154,6 +308,95 @@ export default class Database<KeyIn = NativeValue, KeyOut = Buffer, ValIn = Nati
     return this.getRangeAll(prefix, undefined, opts)
   }
 
+  /**
+   * Read a range with one snapshot transaction per shard, `concurrency`
+   * shards at a time. This is much faster than getRange for big scans, since
+   * the reads are spread over all the storage servers holding the range.
+   * Batches of [key, value] pairs are still yielded in key order:
+   *
+   * ```
+   * for await (const batch of db.parallelScan('a', 'z', {concurrency: 8})) {
+   *   // ...
+   * }
+   * ```
+   *
+   * Every shard starts reading at the same read version, so a scan which
+   * finishes in a few seconds sees a consistent snapshot. Longer scans can't
+   * keep one version. When a shard's transaction fails (eg by getting too
+   * old), that shard carries on from where it got to at a newer version.
+   * Every row is still yielded exactly once. Pass `{consistent: true}` to
+   * fail with transaction_too_old (1007) instead.
+   */
+  parallelScan(start: KeyIn, end?: KeyIn, opts?: ParallelScanOptions): AsyncGenerator<[KeyOut, ValOut][]> {
+    const range = end == null
+      ? this.subspace.packRange(start)
+      : {begin: this.subspace.packKey(start), end: this.subspace.packKey(end)}
+    return parallelScan(this, asBuf(range.begin), asBuf(range.end), opts)
+  }
+
+  getEstimatedRangeSizeBytes(start: KeyIn, end?: KeyIn): Promise<number> {
+    return this.doTransaction(async tn => tn.getEstimatedRangeSizeBytes(start, end))
+  }
+
+  /**
+   * Split a range into chunks of roughly `chunkBytes` bytes each (by
+   * `getEstimatedRangeSizeBytes`), for handing out to parallel jobs. The
+   * chunks cover the whole range, in order.
+   *
+   * The chunk boundaries are raw keys, including this database's prefix,
+   * and usually won't be valid keys for your key encoding. Read the chunks
+   * through `db.getRoot()`.
+   */
+  planRangeSplits(start: KeyIn, end?: KeyIn, opts?: RangeSplitOptions): Promise<RangeSplit[]> {
+    const range = end == null
+      ? this.subspace.packRange(start)
+      : {begin: this.subspace.packKey(start), end: this.subspace.packKey(end)}
+    return planRangeSplits(this, asBuf(range.begin), asBuf(range.end), opts)
+  }
+
+  /**
+   * Scan a range into a RangeRing for other threads to read, then close the
+   * ring. If the scan fails the ring is marked as failed, so readers throw.
+   *
+   * Long scans are spread over as many transactions as they need. When a
+   * transaction fails (including when it runs past the 5 second limit) the
+   * scan carries on from the last batch written, so readers see every row
+   * exactly once. Rows from different transactions may come from different
+   * read versions.
+   *
+   * Resolves to the number of rows read.
+   */
+  async scanIntoRing(ring: RangeRing,
+      start: KeyIn | KeySelector<KeyIn>,
+      end?: KeyIn | KeySelector<KeyIn>, // if undefined, start is used as a prefix.
+      opts: RangeRingOptions = {}): Promise<number> {
+    let total = 0
+    let cursor: Buffer | null = null
+    try {
+      await this.doTn(async tn => {
+        // Retries carry on from the cursor, not from the start.
+        tn._skipReadReplay()
+        let [s, e] = tn._rangeSelectors(start, end)
+        if (cursor != null) {
+          if (!opts.reverse) s = keySelector.firstGreaterThan(cursor)
+          else e = keySelector.firstGreaterOrEqual(cursor)
+        }
+        const limit = opts.limit ? opts.limit - total : 0
+        if (opts.limit && limit <= 0) return
+
+        await tn.snapshot()._getRangeIntoRing(ring, s, e, {...opts, limit}, (lastKey, count) => {
+          cursor = lastKey
+          total += count
+        })
+      })
+    } catch (e) {
+      ring.fail(e)
+      throw e
+    }
+    ring.close()
+    return total
+  }
+
   // These functions all need to return their values because they're returning a child promise.
   atomicOpNative(op: MutationType, key: NativeValue, oper: NativeValue) {
     return this.doOneshot(tn => tn.atomicOpNative(op, key, oper))
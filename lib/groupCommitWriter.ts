@@ -0,0 +1,157 @@
+// Packs blind writes from many callers into shared transactions.
+//
+// Each write is encoded into a packed mutation list (see mutationBatch.ts)
+// as soon as it's made. The list is committed in one transaction at the end
+// of the tick (or lingerMs after its first write), or as soon as it reaches
+// maxBatchBytes. Each caller's promise resolves once the transaction with
+// their write commits.
+//
+// If a batch fails because it's too big or one write in it is invalid, it's
+// split in half and each half is retried on its own. That way one bad write
+// only fails its own caller. Any other error fails every write in the batch:
+// the commit may have landed anyway (eg commit_unknown_result), and retrying
+// it could apply writes (and atomic ops) twice.
+//
+// Only use this for writes which don't depend on anything read in the same
+// transaction. Writes from different callers commit atomically together,
+// and their order within a batch is the order they were made in.
+
+import Database from './database'
+import MutationBatch from './mutationBatch'
+import FDBError from './error'
+import {MutationType} from './opts.g'
+
+export type GroupCommitWriterOptions = {
+  /**
+   * Commit the batch once its packed mutations reach this many bytes.
+   * Defaults to 100kb. FDB transactions are limited to 10MB, and work best
+   * under 1MB.
+   */
+  maxBatchBytes?: number,
+  /**
+   * How long to wait for more writes after the first one in a batch. By
+   * default (0) the batch is committed at the end of the current tick.
+   */
+  lingerMs?: number,
+}
+
+export type GroupCommitWriterStats = {
+  writes: number,
+  /** Transactions committed */
+  commits: number,
+  /** Batches which failed and were split in half to retry */
+  splits: number,
+}
+
+// Errors which mean the batch can never commit as it is, so nothing in it
+// was written.
+const invalidBatchErrors = new Set([
+  2004, // key_outside_legal_range
+  2101, // transaction_too_large
+  2102, // key_too_large
+  2103, // value_too_large
+])
+
+// Anything else thrown by the body (eg applyMutations rejecting a bad
+// mutation) happens before the commit.
+const canSplit = (err: any) => !(err instanceof FDBError) || invalidBatchErrors.has(err.code)
+
+// A caller's write, as a slice of the batch's packed mutation list.
+type PendingWrite = {
+  start: number,
+  end: number,
+  resolve: () => void,
+  reject: (err: any) => void,
+}
+
+export default class GroupCommitWriter<KeyIn, ValIn> {
+  private _db: Database<KeyIn, any, ValIn, any>
+  private _maxBatchBytes: number
+  private _lingerMs: number
+
+  private _batch: MutationBatch<KeyIn, ValIn>
+  private _writes: PendingWrite[] = []
+  private _timer: NodeJS.Timeout | null = null
+  private _scheduled = false
+
+  private _stats: GroupCommitWriterStats = {writes: 0, commits: 0, splits: 0}
+
+  constructor(db: Database<KeyIn, any, ValIn, any>, opts: GroupCommitWriterOptions = {}) {
+    this._db = db
+    this._maxBatchBytes = opts.maxBatchBytes || 100000
+    this._lingerMs = opts.lingerMs || 0
+    this._batch = db.mutationBatch()
+  }
+
+  private _write(addTo: (batch: MutationBatch<KeyIn, ValIn>) => void): Promise<void> {
+    const start = this._batch.byteLength
+    // This throws if the key or value can't be encoded, before we've queued
+    // anything.
+    addTo(this._batch)
+    this._stats.writes++
+
+    const promise = new Promise<void>((resolve, reject) => {
+      this._writes.push({start, end: this._batch.byteLength, resolve, reject})
+    })
+
+    if (this._batch.byteLength >= this._maxBatchBytes) this.flush()
+    else if (!this._scheduled) {
+      this._scheduled = true
+      if (this._lingerMs > 0) this._timer = setTimeout(() => this.flush(), this._lingerMs)
+      else process.nextTick(() => this.flush())
+    }
+    return promise
+  }
+
+  set(key: KeyIn, val: ValIn) { return this._write(b => b.set(key, val)) }
+  clear(key: KeyIn) { return this._write(b => b.clear(key)) }
+  atomicOp(opType: MutationType, key: KeyIn, oper: ValIn) { return this._write(b => b.atomicOp(opType, key, oper)) }
+
+  add(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.Add, key, oper) }
+  max(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.Max, key, oper) }
+  min(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.Min, key, oper) }
+  bitAnd(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.BitAnd, key, oper) }
+  bitOr(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.BitOr, key, oper) }
+  bitXor(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.BitXor, key, oper) }
+  byteMin(key: KeyIn, val: ValIn) { return this.atomicOp(MutationType.ByteMin, key, val) }
+  byteMax(key: KeyIn, val: ValIn) { return this.atomicOp(MutationType.ByteMax, key, val) }
+
+  /** Commit any waiting writes now. */
+  flush() {
+    if (this._timer) clearTimeout(this._timer)
+    this._timer = null
+    this._scheduled = false
+    if (this._writes.length === 0) return
+
+    // The batch's buffer is reused, so take a copy.
+    const buf = Buffer.from(this._batch.toBuffer())
+    const writes = this._writes
+    this._batch.clearAll()
+    this._writes = []
+
+    this._commit(buf, writes)
+  }
+
+  private _commit(buf: Buffer, writes: PendingWrite[]) {
+    const start = writes[0].start, end = writes[writes.length - 1].end
+    const mutations = buf.subarray(start, end)
+
+    this._db.doTn(async tn => { tn.applyMutations(mutations) }).then(() => {
+      this._stats.commits++
+      for (const w of writes) w.resolve()
+    }, err => {
+      if (writes.length === 1 || !canSplit(err)) {
+        for (const w of writes) w.reject(err)
+      } else {
+        this._stats.splits++
+        const mid = writes.length >> 1
+        this._commit(buf, writes.slice(0, mid))
+        this._commit(buf, writes.slice(mid))
+      }
+    })
+  }
+
+  getStats(): GroupCommitWriterStats {
+    return {...this._stats}
+  }
+}
@@ -1,7 +1,6 @@
 // Stuff that hasn't been ported over:
 
 // const Transactional = require('./retryDecorator')
-// const locality = require('./locality')
 // const directory = require('./directory')
 
 import nativeMod, * as fdb from './native'
@@ -39,7 +38,10 @@ const init = () => {
 }
 
 // Destroy the network thread. This is not needed under normal circumstances;
-// but can be used to de-init FDB.
+// but can be used to de-init FDB. The network can't be started again once
+// it has stopped. This only has an effect on the main thread, and if any
+// worker threads are still using the network it's stopped once they've all
+// let go of it.
 export const stopNetworkSync = nativeMod.stopNetwork
 
 export {default as FDBError} from './error'
@@ -50,6 +52,16 @@ export {default as keySelector, KeySelector} from './keySelector'
 export {default as Database} from './database'
 export {default as Transaction, Watch} from './transaction'
 export {default as Subspace, root} from './subspace'
+export {default as PackedRange} from './packedRange'
+export {default as MutationBatch} from './mutationBatch'
+export {TransactionPoolStats} from './transactionPool'
+export {ReadVersionCacheStats} from './readVersionCache'
+export {ReadVersionBatcherStats} from './readVersionBatcher'
+export {default as BatchedReader, BatchedReaderOptions, BatchedReaderStats} from './batchedReader'
+export {default as GroupCommitWriter, GroupCommitWriterOptions, GroupCommitWriterStats} from './groupCommitWriter'
+export {default as RangeRing, RangeRingOptions} from './rangeRing'
+export {ParallelScanOptions} from './parallelScan'
+export {RangeSplit, RangeSplitOptions} from './splitPlanner'
 export {Directory, DirectoryLayer, DirectoryError} from './directory'
 
 export {
@@ -68,6 +80,9 @@ export {
 import {strInc} from './util'
 export const util = {strInc}
 
+import {getBoundaryKeys} from './locality'
+export const locality = {getBoundaryKeys}
+
 import * as tuple from 'fdb-tuple'
 import {TupleItem} from 'fdb-tuple'
 
@@ -112,6 +127,33 @@ export function configNetwork(netOpts: NetworkOptions) {
   eachOption(networkOptionData, netOpts, (code, val) => nativeMod.setNetworkOption(code, val))
 }
 
+/**
+ * Values read with get() which are at least this many bytes long will be
+ * returned as buffers backed directly by the foundationdb client's memory,
+ * rather than being copied into a new buffer. The client memory is released
+ * when the returned buffer is garbage collected, so be careful holding on to
+ * small slices of large values.
+ *
+ * Set to 0 (the default) to always copy.
+ */
+export function setZeroCopyThreshold(bytes: number) {
+  nativeMod.setZeroCopyThreshold(bytes)
+}
+
+/**
+ * Futures resolved by the foundationdb network thread are delivered to
+ * javascript in batches. This sets the maximum number of futures processed in
+ * one event loop iteration before yielding to other I/O. Defaults to 1024.
+ */
+export function setMaxCompletionBatch(count: number) {
+  nativeMod.setMaxCompletionBatch(count)
+}
+
+/** Get performance counters from the native module. */
+export function getNativeStats(): fdb.NativeStats {
+  return nativeMod.getStats()
+}
+
 /**
  * Opens a database and returns it.
  *
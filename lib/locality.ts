@@ -1,11 +1,41 @@
 import Database from './database'
-import Transaction from './transaction'
+import {TransactionOptionCode} from './opts.g'
+import {concat2, strNext} from './util'
 
-export const getBoundaryKeys = (db: Database, begin: Buffer, end: Buffer) => {
-  const tn = db.rawCreateTransaction({
-    read_system_keys: true,
-    lock_aware: true,
-  })
+// Each shard has an entry in \xff/keyServers/ keyed by the first key in the
+// shard.
+const keyServersPrefix = Buffer.from('\xff/keyServers/', 'latin1')
 
-  
-}
\ No newline at end of file
+/**
+ * Get the first key of every shard which starts in the raw key range [begin,
+ * end). The shard containing begin usually starts before it, so its boundary
+ * isn't included unless it's exactly begin.
+ *
+ * The keys aren't read in a single transaction. If the shard map changes
+ * while they're being read, the result may be a mix of old and new
+ * boundaries. That's fine for splitting up work, which is what this is for.
+ */
+export const getBoundaryKeys = async (db: Database<any, any, any, any>, begin: Buffer, end: Buffer): Promise<Buffer[]> => {
+  const result: Buffer[] = []
+  let cursor = begin
+
+  // Like the other bindings, on an error we carry on from the last key read.
+  // The options are passed to doTn as well as set in the body, so that any
+  // shared read version the transaction starts from is lock aware too.
+  await db.getRoot().doTn(async tn => {
+    tn._skipReadReplay()
+    // These aren't persistent, so they need setting again after a retry.
+    tn.setOption(TransactionOptionCode.ReadSystemKeys)
+    tn.setOption(TransactionOptionCode.LockAware)
+
+    for await (const batch of tn.snapshot().getRangeBatch(
+        concat2(keyServersPrefix, cursor), concat2(keyServersPrefix, end))) {
+      for (const [key] of batch) {
+        const boundary = key.slice(keyServersPrefix.length)
+        result.push(boundary)
+        cursor = strNext(boundary)
+      }
+    }
+  }, {read_system_keys: true, lock_aware: true})
+  return result
+}
@@ -0,0 +1,100 @@
+// A batch of writes packed into a single buffer, so they can all be passed to
+// the native module (and applied to a transaction) in one call. This is much
+// faster than calling set() / clear() / atomicOp() for each write when you're
+// writing thousands of keys in a transaction.
+//
+// Keys and values are encoded through the subspace's transformers when
+// they're added to the batch, exactly as the corresponding transaction
+// methods would.
+//
+// The packed format is a list of records. Each record is a one byte op code
+// followed by the key and (except for clears) the value. Keys and values are
+// each prefixed by their length as a uint32 LE. The op code is 0 for set, 1
+// for clear or the MutationType of an atomic op.
+
+import {MutationType} from './opts.g'
+import Subspace, {root, GetSubspace} from './subspace'
+
+const OP_SET = 0
+const OP_CLEAR = 1
+
+export default class MutationBatch<KeyIn = string | Buffer, ValIn = string | Buffer> {
+  private _subspace: Subspace<KeyIn, any, ValIn, any>
+  private _buf: Buffer
+  private _len: number
+
+  /** The number of mutations in the batch */
+  count: number
+
+  /**
+   * Create a batch which encodes keys and values using the specified
+   * subspace, database, transaction or directory.
+   */
+  constructor(subspace: GetSubspace<KeyIn, any, ValIn, any> = root as any, initialCapacity: number = 4096) {
+    this._subspace = subspace.getSubspace()
+    this._buf = Buffer.allocUnsafe(initialCapacity)
+    this._len = 0
+    this.count = 0
+  }
+
+  private _reserve(bytes: number) {
+    if (this._len + bytes <= this._buf.length) return
+    const newBuf = Buffer.allocUnsafe(Math.max(this._buf.length * 2, this._len + bytes))
+    this._buf.copy(newBuf, 0, 0, this._len)
+    this._buf = newBuf
+  }
+
+  private _writeField(data: Buffer | string) {
+    const len = typeof data === 'string' ? Buffer.byteLength(data) : data.length
+    this._reserve(4 + len)
+    this._buf.writeUInt32LE(len, this._len)
+    this._len += 4
+    if (typeof data === 'string') this._buf.write(data, this._len)
+    else data.copy(this._buf, this._len)
+    this._len += len
+  }
+
+  private _push(op: number, key: Buffer | string, val: Buffer | string | null) {
+    this._reserve(1)
+    this._buf[this._len++] = op
+    this._writeField(key)
+    if (val != null) this._writeField(val)
+    this.count++
+    return this
+  }
+
+  set(key: KeyIn, val: ValIn) {
+    return this._push(OP_SET, this._subspace.packKey(key), this._subspace.packValue(val))
+  }
+
+  clear(key: KeyIn) {
+    return this._push(OP_CLEAR, this._subspace.packKey(key), null)
+  }
+
+  atomicOp(opType: MutationType, key: KeyIn, oper: ValIn) {
+    return this._push(opType, this._subspace.packKey(key), this._subspace.packValue(oper))
+  }
+
+  add(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.Add, key, oper) }
+  max(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.Max, key, oper) }
+  min(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.Min, key, oper) }
+  bitAnd(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.BitAnd, key, oper) }
+  bitOr(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.BitOr, key, oper) }
+  bitXor(key: KeyIn, oper: ValIn) { return this.atomicOp(MutationType.BitXor, key, oper) }
+  byteMin(key: KeyIn, val: ValIn) { return this.atomicOp(MutationType.ByteMin, key, val) }
+  byteMax(key: KeyIn, val: ValIn) { return this.atomicOp(MutationType.ByteMax, key, val) }
+
+  /** The size of the packed mutation list in bytes */
+  get byteLength() { return this._len }
+
+  /** Get the packed mutation list. This does not copy. */
+  toBuffer(): Buffer {
+    return this._buf.subarray(0, this._len)
+  }
+
+  /** Remove all mutations from the batch so it can be reused. */
+  clearAll() {
+    this._len = 0
+    this.count = 0
+  }
+}
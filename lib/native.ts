@@ -14,6 +14,15 @@ export type KVList = {
   more: boolean,
 }
 
+// Range results packed into a single buffer. Key i is stored at
+// data[offsets[2i] .. offsets[2i+1]] and its value at
+// data[offsets[2i+1] .. offsets[2i+2]].
+export type PackedKVList = {
+  data: Buffer,
+  offsets: Uint32Array,
+  more: boolean,
+}
+
 export type Watch = {
   cancel(): void
   // Resolves to true if the watch resolved normally. false if the watch it was aborted.
@@ -22,20 +31,45 @@ export type Watch = {
 
 export type Version = Buffer
 
+// A range read which fetches batches ahead of the caller. next() resolves to
+// null once the range is exhausted. Batches are KVLists, or PackedKVLists if
+// the iterator was created with packed=true.
+export interface NativeRangeIterator {
+  next(): Promise<KVList | PackedKVList | null>
+  close(): void
+}
+
 export interface NativeTransaction {
   setOption(code: number, param: string | number | Buffer | null): void
 
   commit(): Promise<void>
   commit(cb: Callback<void>): void
+  commitBlocking(): void
   reset(): void
+  // Destroy the native transaction now rather than when it's garbage
+  // collected. Any further calls throw.
+  dispose(): void
   cancel(): void
   onError(code: number, cb: Callback<void>): void
   onError(code: number): Promise<void>
+  onErrorBlocking(code: number): void
 
   getApproximateSize(): Promise<number>
+  getEstimatedRangeSizeBytes(start: NativeValue, end: NativeValue): Promise<number>
 
   get(key: NativeValue, isSnapshot: boolean): Promise<Buffer | undefined>
   get(key: NativeValue, isSnapshot: boolean, cb: Callback<Buffer | undefined>): void
+  getMaybeSync(key: NativeValue, isSnapshot: boolean): Buffer | undefined | Promise<Buffer | null>
+  // The blocking methods are only allowed in worker threads.
+  getBlocking(key: NativeValue, isSnapshot: boolean): Buffer | undefined
+  getMany(keys: NativeValue[], isSnapshot: boolean): Promise<(Buffer | undefined)[]>
+  prefetch(keys: NativeValue[], isSnapshot: boolean): void
+  prefetchRange(
+    start: NativeValue, beginOrEq: boolean, beginOffset: number,
+    end: NativeValue, endOrEq: boolean, endOffset: number,
+    limit: number, target_bytes: number,
+    mode: StreamingMode, isSnapshot: boolean, reverse: boolean
+  ): void
   // getKey always returns a value - but it will return the empty buffer or a
   // buffer starting in '\xff' if there's no other keys to find.
   getKey(key: NativeValue, orEqual: boolean, offset: number, isSnapshot: boolean): Promise<Buffer>
@@ -44,6 +78,7 @@ export interface NativeTransaction {
   clear(key: NativeValue): void
 
   atomicOp(opType: MutationType, key: NativeValue, operand: NativeValue): void
+  applyMutations(packed: Buffer): void
 
   getRange(
     start: NativeValue, beginOrEq: boolean, beginOffset: number,
@@ -59,6 +94,37 @@ export interface NativeTransaction {
     mode: StreamingMode, iter: number, isSnapshot: boolean, reverse: boolean, cb: Callback<KVList>
   ): void
 
+  getRangeBlocking(
+    start: NativeValue, beginOrEq: boolean, beginOffset: number,
+    end: NativeValue, endOrEq: boolean, endOffset: number,
+    limit: number, target_bytes: number,
+    mode: StreamingMode, iter: number, isSnapshot: boolean, reverse: boolean
+  ): KVList
+
+  getRangePacked(
+    start: NativeValue, beginOrEq: boolean, beginOffset: number,
+    end: NativeValue, endOrEq: boolean, endOffset: number,
+    limit: number, target_bytes: number,
+    mode: StreamingMode, iter: number, isSnapshot: boolean, reverse: boolean
+  ): Promise<PackedKVList>
+
+  getRangeIterator(
+    start: NativeValue, beginOrEq: boolean, beginOffset: number,
+    end: NativeValue, endOrEq: boolean, endOffset: number,
+    limit: number, target_bytes: number,
+    mode: StreamingMode, isSnapshot: boolean, reverse: boolean,
+    packed: boolean, depth: number
+  ): NativeRangeIterator
+
+  // Reads one batch of the range into a RangeRing's memory. See lib/rangeRing.ts.
+  getRangeIntoRing(
+    ring: Uint8Array,
+    start: NativeValue, beginOrEq: boolean, beginOffset: number,
+    end: NativeValue, endOrEq: boolean, endOffset: number,
+    limit: number, target_bytes: number,
+    mode: StreamingMode, iter: number, isSnapshot: boolean, reverse: boolean
+  ): Promise<{count: number, more: boolean, lastKey?: Buffer}>
+
   clearRange(start: NativeValue, end: NativeValue): void
 
   watch(key: NativeValue, ignoreStandardErrs: boolean): Watch
@@ -83,6 +149,44 @@ export interface NativeDatabase {
   close(): void
 }
 
+// Counters from the native module, returned by getStats().
+export type NativeStats = {
+  // Number of futures resolved via the completion queue, and the number of
+  // event loop wakeups used to process them.
+  completions: number
+  completionBatches: number
+  maxCompletionBatch: number
+
+  // Time between the network thread resolving a future and the main thread
+  // picking it up.
+  dispatchLatencyTotalUs: number
+  dispatchLatencyMaxUs: number
+
+  outstandingFutures: number
+
+  // The network thread never waits for javascript. These count how often
+  // (and for how long in total) resolved futures backed up past 16 items
+  // waiting for the main thread. Previously the network thread would have
+  // blocked during that time.
+  maxQueueDepth: number
+  backlogPushes: number
+  backlogUs: number
+
+  // Promises resolved straight away because their future was already ready
+  // when it was created.
+  readyFastPath: number
+
+  // Usage of the freelists for per-future context objects, by context type.
+  // Misses are allocations which fell back to the heap because the pool was
+  // at capacity.
+  ctxPools: {[type: string]: {
+    inUse: number
+    highWater: number
+    capacity: number
+    misses: number
+  }}
+}
+
 export enum ErrorPredicate {
   Retryable = 50000,
   MaybeCommitted = 50001,
@@ -101,6 +205,10 @@ export interface NativeModule {
   setNetworkOption(code: number, param: string | number | Buffer | null): void
 
   errorPredicate(test: ErrorPredicate, code: number): boolean
+
+  setZeroCopyThreshold(bytes: number): void
+  setMaxCompletionBatch(count: number): void
+  getStats(): NativeStats
 }
 
 // Will load a compiled build if present or a prebuild.
@@ -0,0 +1,51 @@
+// A batch of key value pairs returned from the database in packed form. All
+// the keys and values live in a single buffer, and they're only decoded
+// through the subspace's transformers when you ask for them. This lets large
+// range reads avoid allocating a pair of buffers (and an array) for every row.
+
+import {PackedKVList} from './native'
+import {Transformer} from './transformer'
+
+export default class PackedRange<KeyOut, ValOut> {
+  /** The raw packed data returned from the database. */
+  data: Buffer
+  offsets: Uint32Array
+
+  /** The number of key value pairs in this batch */
+  length: number
+
+  private _keyXf: Transformer<any, KeyOut>
+  private _valueXf: Transformer<any, ValOut>
+
+  constructor(packed: PackedKVList, keyXf: Transformer<any, KeyOut>, valueXf: Transformer<any, ValOut>) {
+    this.data = packed.data
+    this.offsets = packed.offsets
+    this.length = (packed.offsets.length - 1) / 2
+    this._keyXf = keyXf
+    this._valueXf = valueXf
+  }
+
+  /** Get the encoded bytes of the key at index i. This does not copy. */
+  rawKey(i: number): Buffer {
+    return this.data.subarray(this.offsets[i*2], this.offsets[i*2+1])
+  }
+
+  /** Get the encoded bytes of the value at index i. This does not copy. */
+  rawValue(i: number): Buffer {
+    return this.data.subarray(this.offsets[i*2+1], this.offsets[i*2+2])
+  }
+
+  key(i: number): KeyOut { return this._keyXf.unpack(this.rawKey(i)) }
+  value(i: number): ValOut { return this._valueXf.unpack(this.rawValue(i)) }
+
+  *[Symbol.iterator](): IterableIterator<[KeyOut, ValOut]> {
+    for (let i = 0; i < this.length; i++) yield [this.key(i), this.value(i)]
+  }
+
+  /** Decode the whole batch into an array of [key, value] pairs */
+  toArray(): [KeyOut, ValOut][] {
+    const result = new Array<[KeyOut, ValOut]>(this.length)
+    for (let i = 0; i < this.length; i++) result[i] = [this.key(i), this.value(i)]
+    return result
+  }
+}
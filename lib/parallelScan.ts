@@ -0,0 +1,165 @@
+// Scan a big range with one transaction per shard, several at a time. Shard
+// boundaries come from the cluster's shard map (see locality.ts), so the
+// reads are spread over the storage servers holding the range instead of
+// all going to one at a time.
+//
+// Batches are still yielded in key order. Each shard's batches are queued
+// until the consumer gets to that shard, and a shard's scan pauses when its
+// queue is full. So at most concurrency * bufferBatches batches are held in
+// memory at once.
+//
+// Every shard starts reading at the same version. But a shard's transaction
+// can only last 5 seconds, and one held up behind a slow consumer will retry
+// - by default at a newer version, carrying on from the last batch it read.
+// So a long scan is not a consistent snapshot unless `consistent` is set.
+
+import Database from './database'
+import Transaction from './transaction'
+import FDBError from './error'
+import keySelector from './keySelector'
+import {StreamingMode} from './opts.g'
+import {Version} from './native'
+import {getBoundaryKeys} from './locality'
+
+export interface ParallelScanOptions {
+  /** Number of shards read at once. Defaults to 4. */
+  concurrency?: number,
+  /**
+   * Number of batches queued for each shard before its scan waits for the
+   * consumer to catch up. Defaults to 16.
+   */
+  bufferBatches?: number,
+  /**
+   * Read every shard at the same version. If any shard takes longer than the
+   * 5 second transaction lifetime, the scan fails with transaction_too_old
+   * (1007) instead of carrying on at a newer version. Defaults to false, in
+   * which case batches from a long scan may come from different versions.
+   */
+  consistent?: boolean,
+}
+
+const stopped = new Error('Scan stopped')
+const tooOld = new Error('Version too old')
+
+// A bounded queue of batches between one shard's scan and the consumer.
+class BatchQueue<T> {
+  private _items: T[] = []
+  private _done = false
+  private _error: any = null
+  private _wakeProducer: (() => void) | null = null
+  private _wakeConsumer: (() => void) | null = null
+
+  constructor(private _max: number, private _isStopped: () => boolean) {}
+
+  private _wake(which: '_wakeProducer' | '_wakeConsumer') {
+    const wake = this[which]
+    this[which] = null
+    if (wake) wake()
+  }
+
+  async push(item: T) {
+    while (this._items.length >= this._max && !this._isStopped()) {
+      await new Promise<void>(resolve => { this._wakeProducer = resolve })
+    }
+    if (this._isStopped()) throw stopped
+    this._items.push(item)
+    this._wake('_wakeConsumer')
+  }
+
+  end(err?: any) {
+    this._done = true
+    this._error = err
+    this._wake('_wakeConsumer')
+  }
+
+  stop() { this._wake('_wakeProducer') }
+
+  async shift(): Promise<T | null> {
+    while (this._items.length === 0) {
+      if (this._done) {
+        if (this._error) throw this._error
+        return null
+      }
+      await new Promise<void>(resolve => { this._wakeConsumer = resolve })
+    }
+    const item = this._items.shift()!
+    this._wake('_wakeProducer')
+    return item
+  }
+}
+
+export default async function* parallelScan<KeyOut, ValOut>(
+    db: Database<any, KeyOut, any, ValOut>, begin: Buffer, end: Buffer,
+    opts: ParallelScanOptions = {}): AsyncGenerator<[KeyOut, ValOut][]> {
+  const concurrency = Math.max(opts.concurrency || 4, 1)
+  const bufferBatches = Math.max(opts.bufferBatches || 16, 1)
+  const consistent = !!opts.consistent
+
+  const points = [begin]
+  for (const key of await getBoundaryKeys(db, begin, end)) {
+    if (Buffer.compare(key, begin) > 0 && Buffer.compare(key, end) < 0) points.push(key)
+  }
+  points.push(end)
+
+  const version: Version = await new Transaction<any, KeyOut, any, ValOut>(db._db.createTransaction(), true, db.subspace)
+    ._exec(tn => tn.getReadVersion())
+
+  const scanShard = async (shardBegin: Buffer, shardEnd: Buffer, queue: BatchQueue<[KeyOut, ValOut][]>) => {
+    let cursor: Buffer | null = null
+    const tn = new Transaction<any, KeyOut, any, ValOut>(db._db.createTransaction(), true, db.subspace)
+    tn._skipReadReplay()
+    let attempt = 0
+    let tooOldError: FDBError | null = null
+    await tn._exec(async tn => {
+      // Unless the scan has to be consistent, only the first attempt uses the
+      // shared version. The usual reason to retry a snapshot read is that the
+      // version is too old.
+      if (consistent || attempt++ === 0) tn.setReadVersion(version)
+      // Retries carry on from the last batch queued.
+      let start = cursor != null ? keySelector.firstGreaterThan(cursor) : keySelector.firstGreaterOrEqual(shardBegin)
+      const end = keySelector.firstGreaterOrEqual(shardEnd)
+      try {
+        for (let iter = 1; ; iter++) {
+          const {results, more} = await tn.getRangeNative(start, end, 0, 0, StreamingMode.WantAll, iter, false)
+          if (results.length) {
+            cursor = results[results.length - 1][0]
+            start = keySelector.firstGreaterThan(cursor)
+            await queue.push(tn._encodeRangeResult(results))
+          }
+          if (!more) break
+        }
+      } catch (e) {
+        // Retrying at the same version would fail the same way. Stop the
+        // retry loop, and fail with the original error below.
+        if (consistent && e instanceof FDBError && e.code === 1007) {
+          tooOldError = e
+          throw tooOld
+        }
+        throw e
+      }
+    }).catch(e => { throw e === tooOld ? tooOldError : e })
+  }
+
+  let isStopped = false
+  const queues: (BatchQueue<[KeyOut, ValOut][]> | undefined)[] = []
+  let started = 0
+
+  try {
+    for (let i = 0; i < points.length - 1; i++) {
+      while (started < points.length - 1 && started < i + concurrency) {
+        const queue = queues[started] = new BatchQueue(bufferBatches, () => isStopped)
+        scanShard(points[started], points[started + 1], queue).then(() => queue.end(), err => queue.end(err))
+        started++
+      }
+
+      const queue = queues[i]!
+      let batch
+      while ((batch = await queue.shift()) != null) yield batch
+      queues[i] = undefined
+    }
+  } finally {
+    // If the consumer stopped early (or a shard failed), stop the others.
+    isStopped = true
+    for (const queue of queues) if (queue) queue.stop()
+  }
+}
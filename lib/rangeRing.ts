@@ -0,0 +1,234 @@
+// A range ring is a SharedArrayBuffer which range reads are copied into
+// straight from the FDB network thread. Any number of other threads can pull
+// batches back out of it, so the decoding and aggregation for one big scan
+// can be spread across a pool of workers. The scan itself doesn't allocate
+// any JS objects for the rows it reads.
+//
+// Usage:
+//
+// ```
+// const ring = new fdb.RangeRing(16 * 1024 * 1024)
+// // Hand ring.buffer to your workers, which open it with new RangeRing(buffer)
+// // and call ring.read() until it returns null.
+// await db.scanIntoRing(ring, 'a', 'z')
+// ```
+//
+// The memory layout must match the native code in src/transaction.cpp. The
+// ring starts with a header of int32 fields, followed by a circular buffer
+// of chunks - one per batch read from the database. Each chunk is:
+//
+//   [size u32] [count u32] [offsets u32 * (2*count + 1)] [keys and values]
+//
+// The offsets are the same as a PackedRange. A size of WRAP marks the end of
+// the used space before the ring wraps around to 0.
+//
+// The producer (the thread running the scan) only ever moves the head. Readers
+// claim whole chunks by bumping TAIL_SEQ with compareExchange, then move the
+// tail. (Claiming on the tail offset itself isn't safe - the ring can wrap
+// back around to the same offset while a slow reader is copying.) The native code
+// can't wake threads blocked in Atomics.wait, so once a batch has been copied
+// the producer's thread bumps SEQ and notifies. (That's the only part of the
+// scan which runs on the producer's JS thread.)
+
+import PackedRange from './packedRange'
+import {GetSubspace, root} from './subspace'
+import FDBError from './error'
+
+const HEADER_BYTES = 32
+
+// Header fields (int32 indexes)
+const HEAD = 0 // Written by the producer
+const TAIL = 1 // Advanced by readers
+const STATE = 2
+const ERROR_CODE = 3
+const SEQ = 4 // Bumped whenever a chunk is published or the state changes
+const TAIL_SEQ = 5 // Odd while a reader is moving the tail. Bumped twice per chunk consumed
+const PRODUCING = 6 // 1 while a scan is writing to the ring
+
+const WRAP = 0xffffffff
+
+const OPEN = 0
+const DONE = 1
+const FAILED = 2
+
+// Keys can be up to 10kb and values up to 100kb. FDB may overshoot the byte
+// target of a batch by up to one row.
+const MAX_ROW_BYTES = 10000 + 100000
+
+export interface RangeRingOptions {
+  /** Target size of each batch in bytes. Defaults to 64kb. */
+  batchBytes?: number,
+  /** Maximum number of rows in each batch. Defaults to 1000. */
+  batchRows?: number,
+  limit?: number,
+  reverse?: boolean,
+}
+
+export const defaultBatchBytes = 65536
+export const defaultBatchRows = 1000
+
+const waitAsync: ((arr: Int32Array, index: number, value: number) => {value: any}) | undefined = (Atomics as any).waitAsync
+
+export default class RangeRing {
+  /** Pass this to other threads, and open it there with `new RangeRing(buffer)`. */
+  readonly buffer: SharedArrayBuffer
+  /** Bytes available for chunks. */
+  readonly capacity: number
+
+  /** @internal The whole ring. This is what gets passed to the native code. */
+  _bytes: Uint8Array
+  private _header: Int32Array
+  private _words: Uint32Array
+
+  constructor(sizeOrBuffer: number | SharedArrayBuffer = 4 * 1024 * 1024) {
+    this.buffer = typeof sizeOrBuffer === 'number'
+      ? new SharedArrayBuffer(HEADER_BYTES + ((sizeOrBuffer + 3) & ~3))
+      : sizeOrBuffer
+    const len = this.buffer.byteLength
+    if (len <= HEADER_BYTES || len % 4 !== 0 || len > 0x7fffffff) {
+      throw new RangeError('Invalid range ring size')
+    }
+
+    this.capacity = this.buffer.byteLength - HEADER_BYTES
+    this._bytes = new Uint8Array(this.buffer)
+    this._header = new Int32Array(this.buffer, 0, HEADER_BYTES / 4)
+    this._words = new Uint32Array(this.buffer, HEADER_BYTES)
+  }
+
+  // *** Producer
+
+  /**
+   * @internal Get the most space a batch with these limits can take up. Throws
+   * if the ring is too small to be sure it'll always fit.
+   */
+  _maxChunkBytes(batchBytes: number, batchRows: number) {
+    const size = (12 + 8 * batchRows + batchBytes + MAX_ROW_BYTES + 3) & ~3
+    // A chunk has to fit on one side of the tail or the other.
+    if (size * 2 + 8 > this.capacity) {
+      throw new RangeError(`Range ring too small - batches need ${size * 2 + 8} bytes of capacity`)
+    }
+    return size
+  }
+
+  /**
+   * @internal Claim the ring for a scan. The ring only supports one producer
+   * at a time - two scans writing at once would interleave their rows, and
+   * could each make room for only one chunk.
+   */
+  _startProducing() {
+    if (Atomics.compareExchange(this._header, PRODUCING, 0, 1) !== 0) {
+      throw Error('Range ring is already being written to by another scan')
+    }
+  }
+
+  /** @internal */
+  _stopProducing() { Atomics.store(this._header, PRODUCING, 0) }
+
+  private _fits(size: number) {
+    const head = Atomics.load(this._header, HEAD)
+    const tail = Atomics.load(this._header, TAIL)
+    // This is the same as ringFit in src/transaction.cpp.
+    if (head >= tail) {
+      return size + (tail === 0 ? 4 : 0) <= this.capacity - head || size + 4 <= tail
+    }
+    return size + 4 <= tail - head
+  }
+
+  /** @internal Wait until readers have made room for a chunk of this size. */
+  async _waitForSpace(size: number) {
+    while (!this._fits(size)) {
+      const seq = Atomics.load(this._header, TAIL_SEQ)
+      if (this._fits(size)) break
+      if (waitAsync) await waitAsync(this._header, TAIL_SEQ, seq).value
+      else await new Promise(resolve => setTimeout(resolve, 1))
+    }
+  }
+
+  private _signal() {
+    Atomics.add(this._header, SEQ, 1)
+    Atomics.notify(this._header, SEQ)
+  }
+
+  /** @internal Called once the native code has copied a chunk into the ring. */
+  _published() { this._signal() }
+
+  /** Mark the scan as finished. Readers get null once they've read everything. */
+  close() {
+    Atomics.compareExchange(this._header, STATE, OPEN, DONE)
+    this._signal()
+  }
+
+  /** Mark the scan as failed. Readers throw once they've read everything. */
+  fail(err: any) {
+    Atomics.store(this._header, ERROR_CODE, err instanceof FDBError ? err.code : -1)
+    Atomics.compareExchange(this._header, STATE, OPEN, FAILED)
+    this._signal()
+  }
+
+  // *** Readers
+
+  /**
+   * Take the next batch from the ring without waiting. Returns undefined if
+   * nothing is available yet, or null if the scan has finished. Throws if the
+   * scan failed.
+   *
+   * Keys are raw, including any subspace prefix. Pass the subspace (or
+   * database) the scan ran in to decode them.
+   */
+  tryRead<KeyOut = Buffer, ValOut = Buffer>(subspace: GetSubspace<any, KeyOut, any, ValOut> = root as any): PackedRange<KeyOut, ValOut> | null | undefined {
+    while (true) {
+      const seq = Atomics.load(this._header, TAIL_SEQ)
+      // Another reader is between claiming a chunk and moving the tail.
+      if (seq & 1) continue
+      const tail = Atomics.load(this._header, TAIL)
+      if (tail === Atomics.load(this._header, HEAD)) {
+        const state = Atomics.load(this._header, STATE)
+        if (state === OPEN) return undefined
+        // Chunks are always published before the state changes.
+        if (tail !== Atomics.load(this._header, HEAD)) continue
+        if (state === DONE) return null
+        const code = Atomics.load(this._header, ERROR_CODE)
+        throw code > 0
+          ? new FDBError('Range scan failed', code)
+          : new Error('Range scan failed')
+      }
+
+      let at = tail
+      let size = this._words[at / 4]
+      if (size === WRAP) {
+        at = 0
+        size = this._words[0]
+      }
+      // Copy the chunk out before claiming it. If another reader gets there
+      // first the producer may overwrite it, but then TAIL_SEQ has moved on
+      // and our claim fails.
+      const chunk = this._bytes.slice(HEADER_BYTES + at, HEADER_BYTES + at + size)
+      const next = at + size === this.capacity ? 0 : at + size
+      if (Atomics.compareExchange(this._header, TAIL_SEQ, seq, (seq + 1) | 0) !== seq) continue
+
+      Atomics.store(this._header, TAIL, next)
+      Atomics.store(this._header, TAIL_SEQ, (seq + 2) | 0)
+      Atomics.notify(this._header, TAIL_SEQ)
+
+      const count = new Uint32Array(chunk.buffer, 4, 1)[0]
+      const offsets = new Uint32Array(chunk.buffer, 8, count * 2 + 1)
+      const data = Buffer.from(chunk.buffer, 8 + offsets.byteLength, offsets[count * 2])
+      const ss = subspace.getSubspace()
+      return new PackedRange({data, offsets, more: false}, ss._bakedKeyXf, ss.valueXf)
+    }
+  }
+
+  /**
+   * Take the next batch from the ring, waiting for one if necessary. Returns
+   * null once the scan has finished. This blocks the calling thread, so it's
+   * meant for workers.
+   */
+  read<KeyOut = Buffer, ValOut = Buffer>(subspace: GetSubspace<any, KeyOut, any, ValOut> = root as any): PackedRange<KeyOut, ValOut> | null {
+    while (true) {
+      const seq = Atomics.load(this._header, SEQ)
+      const batch = this.tryRead(subspace)
+      if (batch !== undefined) return batch
+      Atomics.wait(this._header, SEQ, seq)
+    }
+  }
+}
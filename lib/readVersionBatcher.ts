@@ -0,0 +1,59 @@
+// Shares one read version request between all the transactions which ask
+// for a read version in the same tick.
+//
+// This is only safe for requests made before the GRV is sent. A transaction
+// started after that could miss writes committed in the meantime, so
+// requests made once the batch is in flight wait for the next batch.
+//
+// Transactions are only batched with others which set the same options
+// affecting read versions (see pickGrvOptions), and the shared GRV is made
+// with those options.
+
+import {NativeDatabase, Version} from './native'
+import {TransactionOptions, transactionOptionData} from './opts.g'
+import {eachOption} from './opts'
+import {pickGrvOptions} from './readVersionCache'
+
+export type ReadVersionBatcherStats = {
+  /** Transactions which asked for a read version */
+  requests: number,
+  /** GRV requests actually sent */
+  grvs: number,
+  /** requests - grvs */
+  saved: number,
+}
+
+export default class ReadVersionBatcher {
+  // Batches waiting to be sent, keyed by their read version options.
+  private _pending = new Map<string, Promise<Version>>()
+  private _requests = 0
+  private _grvs = 0
+
+  get(db: NativeDatabase, opts?: TransactionOptions): Promise<Version> {
+    this._requests++
+    const grvOpts = pickGrvOptions(opts)
+    const key = grvOpts == null ? '' : JSON.stringify(grvOpts)
+    let pending = this._pending.get(key)
+    if (pending == null) {
+      pending = new Promise<Version>((resolve, reject) => {
+        process.nextTick(() => {
+          this._pending.delete(key)
+          this._grvs++
+          const tn = db.createTransaction()
+          if (grvOpts) eachOption(transactionOptionData, grvOpts, (code, val) => tn.setOption(code, val))
+          tn.getReadVersion().then(resolve, reject).finally(() => tn.dispose())
+        })
+      })
+      this._pending.set(key, pending)
+    }
+    return pending
+  }
+
+  getStats(): ReadVersionBatcherStats {
+    return {
+      requests: this._requests,
+      grvs: this._grvs,
+      saved: this._requests - this._grvs,
+    }
+  }
+}
@@ -0,0 +1,112 @@
+// Caches a read version for new transactions to use instead of asking the
+// cluster for one. Transactions which use it can see data up to maxStaleness
+// ms old, but their first read skips the GRV round trip.
+//
+// The cache is refreshed lazily: a transaction which finds the version
+// past half its lifetime starts a refresh in the background and uses the
+// old version. A transaction which finds it expired waits for the refresh.
+// There's at most one refresh in flight.
+
+import {NativeDatabase, Version} from './native'
+import {TransactionOptions} from './opts.g'
+
+// Transaction options which change how the cluster hands out read versions.
+// A version fetched without them can't stand in for one fetched with them
+// (eg a transaction which isn't lock aware can't get a read version at all
+// while the database is locked).
+const grvOptionNames: (keyof TransactionOptions)[] = [
+  'priority_system_immediate', 'priority_batch',
+  'lock_aware', 'read_lock_aware',
+  'use_provisional_proxies',
+  'tag', 'auto_throttle_tag',
+]
+
+/** Get the options which affect a transaction's read version, or null if there aren't any. */
+export const pickGrvOptions = (opts?: TransactionOptions): TransactionOptions | null => {
+  if (opts == null) return null
+  let result: TransactionOptions | null = null
+  for (const name of grvOptionNames) {
+    if (opts[name] != null) {
+      if (result == null) result = {}
+      ;(result as any)[name] = opts[name]
+    }
+  }
+  return result
+}
+
+export type ReadVersionCacheStats = {
+  maxStaleness: number,
+
+  /** Transactions which used the cached version straight away */
+  hits: number,
+  /** Transactions which had to wait for a refresh */
+  misses: number,
+  /** GRV requests made to refresh the cache */
+  refreshes: number,
+  hitRate: number,
+}
+
+const now = () => Date.now()
+
+export default class ReadVersionCache {
+  maxStaleness: number
+
+  private _version: Version | null = null
+  // When the request which fetched the version was sent. The version is at
+  // least as new as this.
+  private _fetchedAt = 0
+  private _refreshing: Promise<Version> | null = null
+  private _hits = 0
+  private _misses = 0
+  private _refreshes = 0
+
+  constructor(maxStaleness: number) {
+    this.maxStaleness = maxStaleness
+  }
+
+  /**
+   * Get a read version which is at most maxStaleness ms old. This returns
+   * synchronously when the cached version is fresh enough.
+   */
+  get(db: NativeDatabase): Version | Promise<Version> {
+    const age = now() - this._fetchedAt
+    if (this._version != null && age < this.maxStaleness) {
+      this._hits++
+      if (age >= this.maxStaleness / 2) this._refresh(db).catch(() => {})
+      return this._version
+    } else {
+      this._misses++
+      return this._refresh(db)
+    }
+  }
+
+  private _refresh(db: NativeDatabase): Promise<Version> {
+    if (this._refreshing == null) {
+      const sentAt = now()
+      const tn = db.createTransaction()
+      this._refreshes++
+      this._refreshing = tn.getReadVersion().then(version => {
+        if (sentAt >= this._fetchedAt) {
+          this._version = version
+          this._fetchedAt = sentAt
+        }
+        return version
+      }).finally(() => {
+        this._refreshing = null
+        tn.dispose()
+      })
+    }
+    return this._refreshing
+  }
+
+  getStats(): ReadVersionCacheStats {
+    const total = this._hits + this._misses
+    return {
+      maxStaleness: this.maxStaleness,
+      hits: this._hits,
+      misses: this._misses,
+      refreshes: this._refreshes,
+      hitRate: total === 0 ? 0 : this._hits / total,
+    }
+  }
+}
@@ -0,0 +1,121 @@
+// Split a range into chunks of roughly equal size in bytes, for handing out
+// to parallel jobs. Sizes come from getEstimatedRangeSizeBytes.
+//
+// The range is bisected at the midpoint of its keys until every piece is
+// estimated at chunkBytes or less. Adjacent pieces are then merged back
+// together while they still fit in chunkBytes. Pieces with no data are never
+// split, so sparse parts of the keyspace don't cost much. Each level of the
+// bisection is estimated in parallel.
+
+import Database from './database'
+import keySelector from './keySelector'
+import {strNext} from './util'
+
+export interface RangeSplitOptions {
+  /** Target size of each chunk. Defaults to 100MB. */
+  chunkBytes?: number,
+  /**
+   * Give up splitting a piece after this many bisections. Each bisection
+   * halves the piece's keyspace, not its data - so this needs to be big
+   * enough to get through long common key prefixes. Defaults to 256.
+   */
+  maxDepth?: number,
+}
+
+export type RangeSplit = {
+  /** Raw keys (including any subspace prefix). */
+  begin: Buffer,
+  end: Buffer,
+  /** The estimated size of the chunk */
+  bytes: number,
+}
+
+const defaultChunkBytes = 100 * 1024 * 1024
+
+// Number of estimates requested per transaction.
+const estimateBatchSize = 100
+
+// Get a key half way between a and b, treating both as base 256 fractions.
+// Returns null if there's nothing in between.
+export const keyMidpoint = (a: Buffer, b: Buffer): Buffer | null => {
+  const len = Math.max(a.length, b.length) + 1
+  const sum = new Uint8Array(len)
+  let carry = 0
+  for (let i = len - 1; i >= 0; i--) {
+    const s = (i < a.length ? a[i] : 0) + (i < b.length ? b[i] : 0) + carry
+    sum[i] = s & 0xff
+    carry = s >> 8
+  }
+
+  const mid = Buffer.alloc(len)
+  let rem = carry
+  for (let i = 0; i < len; i++) {
+    const v = rem * 256 + sum[i]
+    mid[i] = v >> 1
+    rem = v & 1
+  }
+
+  // Trailing zeros just make the key longer.
+  let end = len
+  while (end > 0 && mid[end - 1] === 0) end--
+  const trimmed = mid.subarray(0, end)
+  if (Buffer.compare(trimmed, a) > 0) return trimmed
+  return Buffer.compare(mid, a) > 0 && Buffer.compare(mid, b) < 0 ? mid : null
+}
+
+export default async function planRangeSplits(db: Database<any, any, any, any>,
+    begin: Buffer, end: Buffer, opts: RangeSplitOptions = {}): Promise<RangeSplit[]> {
+  const chunkBytes = opts.chunkBytes || defaultChunkBytes
+  const maxDepth = opts.maxDepth == null ? 256 : opts.maxDepth
+  const root = db.getRoot()
+
+  // Start from the first and last keys actually in the range, so we don't
+  // spend bisections finding where the data is.
+  const [first, last] = await root.doTn(tn => Promise.all([
+    tn.snapshot().getKey(keySelector.firstGreaterOrEqual(begin)),
+    tn.snapshot().getKey(keySelector.lastLessThan(end)),
+  ]))
+  if (first == null || last == null || Buffer.compare(first, end) >= 0 || Buffer.compare(last, first) < 0) {
+    return [{begin, end, bytes: 0}]
+  }
+
+  const estimate = async (ranges: [Buffer, Buffer][]) => {
+    const sizes: number[] = []
+    for (let i = 0; i < ranges.length; i += estimateBatchSize) {
+      const batch = ranges.slice(i, i + estimateBatchSize)
+      sizes.push(...await root.doTn(tn => Promise.all(batch.map(([b, e]) => tn.getEstimatedRangeSizeBytes(b, e)))))
+    }
+    return sizes
+  }
+
+  const leaves: RangeSplit[] = []
+  let pending: RangeSplit[] = [{begin: first, end: strNext(last), bytes: 0}]
+  pending[0].bytes = (await estimate([[pending[0].begin, pending[0].end]]))[0]
+
+  for (let depth = 0; pending.length; depth++) {
+    const halves: [Buffer, Buffer][] = []
+    for (const piece of pending) {
+      const mid = piece.bytes > chunkBytes && depth < maxDepth ? keyMidpoint(piece.begin, piece.end) : null
+      if (mid == null) leaves.push(piece)
+      else halves.push([piece.begin, mid], [mid, piece.end])
+    }
+
+    const sizes = await estimate(halves)
+    pending = halves.map(([begin, end], i) => ({begin, end, bytes: sizes[i]}))
+  }
+
+  leaves.sort((a, b) => Buffer.compare(a.begin, b.begin))
+  const result: RangeSplit[] = []
+  for (const leaf of leaves) {
+    const prev = result[result.length - 1]
+    if (prev && prev.bytes + leaf.bytes <= chunkBytes) {
+      prev.end = leaf.end
+      prev.bytes += leaf.bytes
+    } else result.push({...leaf})
+  }
+
+  // Cover the whole of the requested range.
+  result[0].begin = begin
+  result[result.length - 1].end = end
+  return result
+}
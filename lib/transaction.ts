@@ -5,6 +5,7 @@ import {
   Callback,
   NativeValue,
   Version,
+  PackedKVList,
 } from './native'
 import {
   strInc,
@@ -32,6 +33,10 @@ import {
   packVersionstampPrefixSuffix
 } from './versionstamp'
 import Subspace, { GetSubspace } from './subspace'
+import PackedRange from './packedRange'
+import MutationBatch from './mutationBatch'
+import TransactionPool from './transactionPool'
+import RangeRing, {RangeRingOptions, defaultBatchBytes, defaultBatchRows} from './rangeRing'
 
 const byteZero = Buffer.alloc(1)
 byteZero.writeUInt8(0, 0)
@@ -42,6 +47,26 @@ export interface RangeOptionsBatch {
   streamingMode?: StreamingMode,
   limit?: number,
   reverse?: boolean,
+
+  /**
+   * Fetch each batch from the database as a single packed buffer rather than
+   * as a buffer per key and value. When set, getRangeBatch yields PackedRange
+   * objects which only decode keys and values when they're accessed. This
+   * makes large scans much cheaper on the JS heap.
+   */
+  packed?: boolean,
+
+  /**
+   * Keep up to this many batches buffered or in flight ahead of the consumer.
+   * The next batch is requested as soon as the previous one arrives, rather
+   * than when your code asks for it. This makes large scans much faster when
+   * you do any work on each batch.
+   *
+   * Note that if you stop iterating early, batches you never looked at may
+   * still have been read (and added to the transaction's read conflict
+   * range). Defaults to 0 (no read-ahead).
+   */
+  readAhead?: number,
 }
 
 export interface RangeOptions extends RangeOptionsBatch {
@@ -74,8 +99,44 @@ interface TxnCtx {
   // the versionstamp from the txn and bake it back into the tuple (or
   // whatever) after the transaction commits.
   toBake: null | BakeItem<any>[]
+
+  // Set when the transaction does anything which needs a commit to take
+  // effect - writes, write conflict ranges and watches. _exec skips the
+  // commit for transactions which only read.
+  needsCommit: boolean
+
+  // Set if the transaction created a watch. Resetting or disposing the
+  // transaction could cancel the watch, so these transactions are left for
+  // the garbage collector.
+  hasWatches: boolean
+
+  // Set once doTn has finished with the transaction. The native transaction
+  // may have been reset and handed to another doTn call by then, so every
+  // transaction object sharing this context refuses to touch it.
+  released: boolean
+
+  // Reads made by the current attempt. If the transaction retries, they're
+  // all started at once before the body runs again. The body will usually
+  // make the same reads, and they'll then be served from the transaction's
+  // read cache instead of each waiting for a round trip in turn.
+  readKeys: NativeValue[]
+  readRanges: RecordedRange[]
+
+  // Cleared for transactions whose retries don't make the same reads again
+  // (see _skipReadReplay).
+  recordReads: boolean
 }
 
+// The arguments of the first getRange call for a range read.
+type RecordedRange = [
+  NativeValue, boolean, number,
+  NativeValue, boolean, number,
+  number, number, StreamingMode, boolean
+]
+
+// Reads past this many aren't recorded for replay on retry.
+const MAX_RECORDED_READS = 1000
+
 /**
  * This class wraps a foundationdb transaction object. All interaction with the
  * data in a foundationdb database happens through a transaction. For more
@@ -118,7 +179,7 @@ interface TxnCtx {
  * apply a value transformer this will change.
  */
 export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = NativeValue, ValOut = Buffer> {
-  /** @internal */ _tn: NativeTransaction
+  private _native: NativeTransaction
   
   isSnapshot: boolean
   subspace: Subspace<KeyIn, KeyOut, ValIn, ValOut>
@@ -140,7 +201,7 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
       subspace: Subspace<KeyIn, KeyOut, ValIn, ValOut>,
       // keyEncoding: Transformer<KeyIn, KeyOut>, valueEncoding: Transformer<ValIn, ValOut>,
       opts?: TransactionOptions, ctx?: TxnCtx) {
-    this._tn = tn
+    this._native = tn
 
     this.isSnapshot = snapshot
     this.subspace = subspace
@@ -152,25 +213,104 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
 
     this._ctx = ctx ? ctx : {
       nextCode: 0,
-      toBake: null
+      toBake: null,
+      needsCommit: false,
+      hasWatches: false,
+      released: false,
+      readKeys: [],
+      readRanges: [],
+      recordReads: true,
     }
   }
 
-  // Internal method to actually run a transaction retry loop. Do not call
-  // this directly - instead use Database.doTn().
+  /** @internal The native transaction. Throws once doTn has finished with it. */
+  get _tn(): NativeTransaction {
+    if (this._ctx.released) throw Error('Transaction has been disposed')
+    return this._native
+  }
 
-  /** @internal */
-  async _exec<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => Promise<T>, opts?: TransactionOptions): Promise<T> {
+  /**
+   * Run body in a retry loop, then release the native transaction. If the
+   * transaction succeeds and a pool is passed, it's returned to the pool.
+   * Otherwise it's disposed. Either way this transaction can't be used once
+   * the returned promise settles.
+   *
+   * If readVersion is passed, the first attempt reads at the version it
+   * returns instead of asking the cluster for one.
+   *
+   * @internal
+   */
+  async _exec<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => Promise<T>, opts?: TransactionOptions, pool?: TransactionPool,
+      readVersion?: () => Version | Promise<Version>): Promise<T> {
+    let ok = false
+    try {
+      const result = await this._retryLoop(body, readVersion)
+      ok = true
+      return result
+    } finally {
+      this._ctx.released = true
+      // Resetting or destroying a transaction cancels its uncommitted
+      // watches. Leave those for the garbage collector.
+      if (!this._ctx.hasWatches) {
+        if (ok && pool) pool.release(this._native)
+        else this._native.dispose()
+      }
+    }
+  }
+
+  /**
+   * The blocking equivalent of _exec. Worker threads only.
+   *
+   * @internal
+   */
+  _execBlocking<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => T): T {
+    // There's nothing to prefetch reads into between blocking attempts.
+    this._skipReadReplay()
+    try {
+      do {
+        try {
+          const result = body(this)
+          if (this._ctx.toBake && this._ctx.toBake.length) {
+            throw Error('Versionstamped tuples are not supported in blocking transactions')
+          }
+          if (this._ctx.needsCommit) this._tn.commitBlocking()
+          return result
+        } catch (err) {
+          if (err instanceof FDBError) this._tn.onErrorBlocking(err.code)
+          else throw err
+        }
+
+        this._ctx.nextCode = 0
+        this._ctx.needsCommit = false
+        if (this._ctx.toBake) this._ctx.toBake.length = 0
+      } while (true)
+    } finally {
+      this._ctx.released = true
+      if (!this._ctx.hasWatches) this._native.dispose()
+    }
+  }
+
+  private async _retryLoop<T>(body: (tn: Transaction<KeyIn, KeyOut, ValIn, ValOut>) => Promise<T>,
+      readVersion?: () => Version | Promise<Version>): Promise<T> {
     // Logic described here:
     // https://apple.github.io/foundationdb/api-c.html#c.fdb_transaction_on_error
     do {
       try {
+        if (readVersion) {
+          // Retries get their own read version.
+          const v = readVersion()
+          readVersion = undefined
+          this.setReadVersion(v instanceof Promise ? await v : v)
+        }
+
         const result = await body(this)
 
         const stampPromise = (this._ctx.toBake && this._ctx.toBake.length)
           ? this.getVersionstamp() : null
 
-        await this.rawCommit()
+        // Committing a read-only transaction doesn't do anything, but it still
+        // costs a round trip through the native module.
+        if (this._ctx.needsCommit) await this.rawCommit()
 
         if (stampPromise) {
           const stamp = await stampPromise.promise
@@ -190,10 +330,45 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
 
       // Reset our local state that will have been filled in by calling the body.
       this._ctx.nextCode = 0
+      this._ctx.needsCommit = false
       if (this._ctx.toBake) this._ctx.toBake.length = 0
+      this._prefetchRecordedReads()
     } while (true)
   }
 
+  /**
+   * @internal Don't prefetch this transaction's reads when it retries. Scans
+   * which carry on from a cursor after a retry use this, since the reads the
+   * last attempt made are the ones they've already consumed.
+   */
+  _skipReadReplay() {
+    this._ctx.recordReads = false
+    this._ctx.readKeys = []
+    this._ctx.readRanges = []
+  }
+
+  private _recordKey(key: NativeValue) {
+    const keys = this._ctx.readKeys
+    if (this._ctx.recordReads && keys.length < MAX_RECORDED_READS) keys.push(key)
+  }
+
+  // Start all the reads the last attempt made. These are snapshot reads, so
+  // they don't add conflict ranges for keys the next attempt doesn't read.
+  // Gets in the body pick up the prefetched reads directly (adding the
+  // conflict range then if needed). Range reads are served from the read
+  // cache the prefetches fill.
+  private _prefetchRecordedReads() {
+    const {readKeys, readRanges} = this._ctx
+    this._ctx.readKeys = []
+    this._ctx.readRanges = []
+
+    if (readKeys.length) this._tn.prefetch(readKeys, true)
+    for (const [start, startOrEq, startOffset, end, endOrEq, endOffset, limit, targetBytes, mode, reverse] of readRanges) {
+      this._tn.prefetchRange(start, startOrEq, startOffset, end, endOrEq, endOffset,
+        limit, targetBytes, mode, true, reverse)
+    }
+  }
+
   /**
    * Set options on the transaction object. These options can have a variety of
    * effects - see TransactionOptionCode for details. For options which are
@@ -244,6 +419,13 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
       : this._tn.commit()
   }
 
+  /**
+   * Commit the transaction, blocking the thread until it's done. This is
+   * only allowed in worker threads. Most users should use
+   * `db.doTnBlocking()` instead.
+   */
+  commitBlocking() { this._tn.commitBlocking() }
+
   rawReset() { this._tn.reset() }
   rawCancel() { this._tn.cancel() }
 
@@ -267,6 +449,7 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
   get(key: KeyIn, cb: Callback<ValOut | undefined>): void
   get(key: KeyIn, cb?: Callback<ValOut | undefined>) {
     const keyBuf = this._keyEncoding.pack(key)
+    this._recordKey(keyBuf)
     return cb
       ? this._tn.get(keyBuf, this.isSnapshot, (err, val) => {
         cb(err, val == null ? undefined : this._valueEncoding.unpack(val))
@@ -275,11 +458,83 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
         .then(val => val == null ? undefined : this._valueEncoding.unpack(val))
   }
 
+  /**
+   * Get the value for the specified key, blocking the thread until it's
+   * available. This skips all the promise machinery, so it's much faster for
+   * sequential reads. It's only allowed in worker threads - on the main
+   * thread it would stall the event loop, so it throws.
+   */
+  getBlocking(key: KeyIn): ValOut | undefined {
+    const keyBuf = this._keyEncoding.pack(key)
+    this._recordKey(keyBuf)
+    const val = this._tn.getBlocking(keyBuf, this.isSnapshot)
+    return val == null ? undefined : this._valueEncoding.unpack(val)
+  }
+
+  /**
+   * Like `get()`, but if the value is available straight away it's returned
+   * directly instead of through a promise. This is usually the case for keys
+   * which were already read or written in this transaction, since those reads
+   * are served from the transaction's cache. Otherwise this returns a promise.
+   *
+   * ```javascript
+   * let val = tn.getMaybeSync(key)
+   * if (val instanceof Promise) val = await val
+   * ```
+   */
+  getMaybeSync(key: KeyIn): ValOut | undefined | Promise<ValOut | undefined> {
+    const keyBuf = this._keyEncoding.pack(key)
+    this._recordKey(keyBuf)
+    const val = this._tn.getMaybeSync(keyBuf, this.isSnapshot)
+    if (val instanceof Promise) return val.then(val => val == null ? undefined : this._valueEncoding.unpack(val))
+    return val == null ? undefined : this._valueEncoding.unpack(val)
+  }
+
+  /**
+   * Get the values of many keys at once. This is equivalent to
+   * `Promise.all(keys.map(k => tn.get(k)))`, but much cheaper because all the
+   * reads are started and collected in a single native call.
+   */
+  getMany(keys: KeyIn[]): Promise<(ValOut | undefined)[]> {
+    const keyBufs = keys.map(k => this._keyEncoding.pack(k))
+    for (let i = 0; i < keyBufs.length; i++) this._recordKey(keyBufs[i])
+    return this._tn.getMany(keyBufs, this.isSnapshot)
+      .then(vals => vals.map(val => val == null ? undefined : this._valueEncoding.unpack(val)))
+  }
+
+  /**
+   * Start reading keys without waiting for the results. Later calls to
+   * `get()` or `getMany()` for these keys pick up the reads where they are,
+   * so a transaction which knows what it'll read can start all its reads at
+   * once and still `await` them one at a time.
+   *
+   * Prefetching through a snapshot scope doesn't add read conflicts until
+   * the keys are read with `get()`. Writing a key discards its prefetched
+   * read, and unclaimed reads are discarded when the transaction resets or
+   * retries.
+   */
+  prefetch(keys: KeyIn[]) {
+    this._tn.prefetch(keys.map(k => this._keyEncoding.pack(k)), this.isSnapshot)
+  }
+
+  /**
+   * Start reading the first batch of a range without waiting for the
+   * results. A later range read over the same range is served from the
+   * transaction's read cache. The arguments are the same as getRange.
+   */
+  prefetchRange(start: KeyIn | KeySelector<KeyIn>, end?: KeyIn | KeySelector<KeyIn>, opts: RangeOptions = {}) {
+    const [s, e] = this._rangeSelectors(start, end)
+    this._tn.prefetchRange(s.key, s.orEqual, s.offset, e.key, e.orEqual, e.offset,
+      opts.limit || 0, 0, opts.streamingMode == null ? StreamingMode.Iterator : opts.streamingMode,
+      this.isSnapshot, opts.reverse || false)
+  }
+
   /** Checks if the key exists in the database. This is just a shorthand for
    * tn.get() !== undefined.
    */
   exists(key: KeyIn): Promise<boolean> {
     const keyBuf = this._keyEncoding.pack(key)
+    this._recordKey(keyBuf)
     return this._tn.get(keyBuf, this.isSnapshot).then(val => val != undefined)
   }
 
@@ -312,12 +567,14 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
 
   /** Set the specified key/value pair in the database */
   set(key: KeyIn, val: ValIn) {
+    this._ctx.needsCommit = true
     this._tn.set(this._keyEncoding.pack(key), this._valueEncoding.pack(val))
   }
 
   /** Remove the value for the specified key */
   clear(key: KeyIn) {
     const pack = this._keyEncoding.pack(key)
+    this._ctx.needsCommit = true
     this._tn.clear(pack)
   }
 
@@ -326,8 +583,36 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
     return this.clear(key)
   }
 
-  // This just destructively edits the result in-place.
-  private _encodeRangeResult(r: [Buffer, Buffer][]): [KeyOut, ValOut][] {
+  /**
+   * Create an empty mutation batch which encodes keys and values using this
+   * transaction's subspace. Fill it and pass it to `applyMutations()`.
+   */
+  mutationBatch(): MutationBatch<KeyIn, ValIn> {
+    return new MutationBatch(this.subspace)
+  }
+
+  /**
+   * Apply all the writes in a mutation batch (or a buffer packed in the same
+   * format) to this transaction in a single native call. This is much faster
+   * than calling `set()` / `clear()` / `atomicOp()` for each key when you're
+   * writing lots of keys.
+   *
+   * Keys in the batch are encoded by the batch's subspace, not the
+   * transaction's.
+   */
+  applyMutations(batch: MutationBatch<any, any> | Buffer) {
+    this._ctx.needsCommit = true
+    this._tn.applyMutations(Buffer.isBuffer(batch) ? batch : batch.toBuffer())
+  }
+
+  // This just destructively edits the result in-place. Packed results are
+  // wrapped, and decoded lazily when accessed.
+  /** @internal */
+  _encodeRangeResult(r: [Buffer, Buffer][]): [KeyOut, ValOut][]
+  _encodeRangeResult(r: PackedKVList): PackedRange<KeyOut, ValOut>
+  _encodeRangeResult(r: [Buffer, Buffer][] | PackedKVList): [KeyOut, ValOut][] | PackedRange<KeyOut, ValOut> {
+    if (!Array.isArray(r)) return new PackedRange(r, this._keyEncoding, this._valueEncoding)
+
     // This is slightly faster but I have to throw away the TS checks in the process. :/
     for (let i = 0; i < r.length; i++) {
       ;(r as any)[i][0] = this._keyEncoding.unpack(r[i][0])
@@ -336,11 +621,22 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
     return r as any as [KeyOut, ValOut][]
   }
 
+  private _recordRange(start: KeySelector<NativeValue>, end: KeySelector<NativeValue>,
+      limit: number, targetBytes: number, streamingMode: StreamingMode, reverse: boolean) {
+    const ranges = this._ctx.readRanges
+    if (this._ctx.recordReads && ranges.length < MAX_RECORDED_READS) ranges.push([
+      start.key, start.orEqual, start.offset,
+      end.key, end.orEqual, end.offset,
+      limit, targetBytes, streamingMode, reverse
+    ])
+  }
+
   getRangeNative(start: KeySelector<NativeValue>,
       end: KeySelector<NativeValue> | null,  // If not specified, start is used as a prefix.
       limit: number, targetBytes: number, streamingMode: StreamingMode,
       iter: number, reverse: boolean): Promise<KVList<Buffer, Buffer>> {
     const _end = end != null ? end : keySelector.firstGreaterOrEqual(strInc(start.key))
+    if (iter === 1) this._recordRange(start, _end, limit, targetBytes, streamingMode, reverse)
     return this._tn.getRange(
       start.key, start.orEqual, start.offset,
       _end.key, _end.orEqual, _end.offset,
@@ -348,6 +644,20 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
       iter, this.isSnapshot, reverse)
   }
 
+  /** Same as getRangeNative, but the results are returned packed into a single buffer. */
+  getRangeNativePacked(start: KeySelector<NativeValue>,
+      end: KeySelector<NativeValue> | null,  // If not specified, start is used as a prefix.
+      limit: number, targetBytes: number, streamingMode: StreamingMode,
+      iter: number, reverse: boolean): Promise<PackedKVList> {
+    const _end = end != null ? end : keySelector.firstGreaterOrEqual(strInc(start.key))
+    if (iter === 1) this._recordRange(start, _end, limit, targetBytes, streamingMode, reverse)
+    return this._tn.getRangePacked(
+      start.key, start.orEqual, start.offset,
+      _end.key, _end.orEqual, _end.offset,
+      limit, targetBytes, streamingMode,
+      iter, this.isSnapshot, reverse)
+  }
+
   getRangeRaw(start: KeySelector<KeyIn>, end: KeySelector<KeyIn> | null,
       limit: number, targetBytes: number, streamingMode: StreamingMode,
       iter: number, reverse: boolean): Promise<KVList<KeyOut, ValOut>> {
@@ -374,36 +684,105 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
    * }
    * ```
    * 
+   * If `packed: true` is passed in the options, each batch is instead a
+   * PackedRange, which decodes keys and values as they're accessed:
+   * 
+   * ```
+   * for await (const batch of tn.getRangeBatch(0, 1000, {packed: true})) {
+   *   for (let k = 0; k < batch.length; k++) {
+   *     const val = batch.value(k)
+   *     // ...
+   *   }
+   * }
+   * ```
+   * 
    * @see Transaction.getRange
    */
-  async *getRangeBatch(
-      _start: KeyIn | KeySelector<KeyIn>, // Consider also supporting string / buffers for these.
-      _end?: KeyIn | KeySelector<KeyIn>, // If not specified, start is used as a prefix.
-      opts: RangeOptions = {}) {
-
+  /** @internal */
+  _rangeSelectors(_start: KeyIn | KeySelector<KeyIn>, _end?: KeyIn | KeySelector<KeyIn>): [KeySelector<NativeValue>, KeySelector<NativeValue>] {
     // This is a bit of a dog's breakfast. We're trying to handle a lot of different cases here:
     // - The start and end parameters can be specified as keys or as selectors
     // - The end parameter can be missing / null, and if it is we want to "do the right thing" here
     //   - Which normally means searching between [start, strInc(start)]
     //   - But with tuple encoding this means between [start + '\x00', start + '\xff']
-
-    let start: KeySelector<string | Buffer>, end: KeySelector<string | Buffer>
     const startSelEnc = keySelector.from(_start)
-    
+
     if (_end == null) {
       const range = this.subspace.packRange(startSelEnc.key)
-      start = keySelector(range.begin, startSelEnc.orEqual, startSelEnc.offset)
-      end = keySelector.firstGreaterOrEqual(range.end)
+      return [
+        keySelector(range.begin, startSelEnc.orEqual, startSelEnc.offset),
+        keySelector.firstGreaterOrEqual(range.end)
+      ]
     } else {
-      start = keySelector.toNative(startSelEnc, this._keyEncoding)
-      end = keySelector.toNative(keySelector.from(_end), this._keyEncoding)
+      return [
+        keySelector.toNative(startSelEnc, this._keyEncoding),
+        keySelector.toNative(keySelector.from(_end), this._keyEncoding)
+      ]
     }
+  }
+
+  getRangeBatch(start: KeyIn | KeySelector<KeyIn>, end: KeyIn | KeySelector<KeyIn> | undefined,
+    opts: RangeOptions & {packed: true}): AsyncGenerator<PackedRange<KeyOut, ValOut>>
+  getRangeBatch(start: KeyIn | KeySelector<KeyIn>, end?: KeyIn | KeySelector<KeyIn>,
+    opts?: RangeOptions): AsyncGenerator<[KeyOut, ValOut][]>
+  async *getRangeBatch(
+      _start: KeyIn | KeySelector<KeyIn>, // Consider also supporting string / buffers for these.
+      _end?: KeyIn | KeySelector<KeyIn>, // If not specified, start is used as a prefix.
+      opts: RangeOptions = {}): AsyncGenerator<[KeyOut, ValOut][] | PackedRange<KeyOut, ValOut>> {
+
+    let [start, end] = this._rangeSelectors(_start, _end)
 
     let limit = opts.limit || 0
     const streamingMode = opts.streamingMode == null ? StreamingMode.Iterator : opts.streamingMode
 
+    if (opts.readAhead) {
+      const reverse = opts.reverse || false
+      this._recordRange(start, end, limit, 0, streamingMode, reverse)
+      const it = this._tn.getRangeIterator(
+        start.key, start.orEqual, start.offset,
+        end.key, end.orEqual, end.offset,
+        limit, 0, streamingMode, this.isSnapshot, reverse,
+        !!opts.packed, opts.readAhead)
+      try {
+        while (1) {
+          const batch = await it.next()
+          // Don't hand out batches buffered before doTn finished.
+          if (this._ctx.released) throw Error('Transaction has been disposed')
+          if (batch == null) break
+          yield opts.packed
+            ? this._encodeRangeResult(batch as PackedKVList)
+            : this._encodeRangeResult((batch as KVList<Buffer, Buffer>).results)
+        }
+      } finally {
+        // Stop fetching if the caller bailed out early.
+        it.close()
+      }
+      return
+    }
+
     let iter = 0
     while (1) {
+      if (opts.packed) {
+        const packed = await this.getRangeNativePacked(start, end,
+          limit, 0, streamingMode, ++iter, opts.reverse || false)
+        const batch = this._encodeRangeResult(packed)
+
+        if (batch.length) {
+          const lastKey = batch.rawKey(batch.length - 1)
+          if (!opts.reverse) start = keySelector.firstGreaterThan(lastKey)
+          else end = keySelector.firstGreaterOrEqual(lastKey)
+        }
+
+        yield batch
+        if (!packed.more) break
+
+        if (limit) {
+          limit -= batch.length
+          if (limit <= 0) break
+        }
+        continue
+      }
+
       const {results, more} = await this.getRangeNative(start, end,
         limit, 0, streamingMode, ++iter, opts.reverse || false)
 
@@ -464,6 +843,8 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
    * - **streamingMode:** (enum StreamingMode) *(rarely used)* The policy for
    *   how eager FDB should be about prefetching data. See enum StreamingMode in
    *   opts.
+   * - **readAhead:** (number) Fetch up to this many batches ahead of the
+   *   loop consuming them. See RangeOptionsBatch.readAhead.
    */
   async *getRange(
       start: KeyIn | KeySelector<KeyIn>, // Consider also supporting string / buffers for these.
@@ -493,12 +874,119 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
     if (childOpts.streamingMode == null) childOpts.streamingMode = StreamingMode.WantAll
 
     const result: [KeyOut, ValOut][] = []
-    for await (const batch of this.getRangeBatch(start, end, childOpts)) {
-      result.push.apply(result, batch)
+    if (childOpts.packed) {
+      for await (const batch of this.getRangeBatch(start, end, {...childOpts, packed: true})) {
+        result.push.apply(result, batch.toArray())
+      }
+    } else {
+      for await (const batch of this.getRangeBatch(start, end, childOpts)) {
+        result.push.apply(result, batch)
+      }
     }
     return result
   }
 
+  /**
+   * The blocking equivalent of getRangeAll. Worker threads only - see
+   * `getBlocking()`.
+   */
+  getRangeBlocking(
+      _start: KeyIn | KeySelector<KeyIn>,
+      _end?: KeyIn | KeySelector<KeyIn>, // if undefined, start is used as a prefix.
+      opts: RangeOptions = {}): [KeyOut, ValOut][] {
+    let [start, end] = this._rangeSelectors(_start, _end)
+    let limit = opts.limit || 0
+    const reverse = opts.reverse || false
+    const streamingMode = opts.streamingMode == null ? StreamingMode.WantAll : opts.streamingMode
+
+    const result: [KeyOut, ValOut][] = []
+    for (let iter = 1; ; iter++) {
+      if (iter === 1) this._recordRange(start, end, limit, 0, streamingMode, reverse)
+      const {results, more} = this._tn.getRangeBlocking(
+        start.key, start.orEqual, start.offset,
+        end.key, end.orEqual, end.offset,
+        limit, 0, streamingMode, iter, this.isSnapshot, reverse)
+
+      if (results.length) {
+        if (!reverse) start = keySelector.firstGreaterThan(results[results.length-1][0])
+        else end = keySelector.firstGreaterOrEqual(results[results.length-1][0])
+      }
+      result.push.apply(result, this._encodeRangeResult(results))
+      if (!more) break
+
+      if (limit) {
+        limit -= results.length
+        if (limit <= 0) break
+      }
+    }
+    return result
+  }
+
+  /**
+   * Read a range straight into a RangeRing, for other threads to consume.
+   * Each batch is copied into the ring by the FDB network thread, without
+   * creating any JS objects for the rows. If the ring is full this waits for
+   * readers to make room.
+   *
+   * This doesn't close the ring when it's done, so you can scan several
+   * ranges into the same ring one after another. Only one scan can write to
+   * a ring at a time - this throws if another is still running. Resolves to
+   * the number of rows read. Rows
+   * from a failed attempt stay in the ring - see `db.scanIntoRing()`, which
+   * carries on from where it left off instead.
+   */
+  getRangeIntoRing(
+      ring: RangeRing,
+      _start: KeyIn | KeySelector<KeyIn>,
+      _end?: KeyIn | KeySelector<KeyIn>, // if undefined, start is used as a prefix.
+      opts: RangeRingOptions = {}): Promise<number> {
+    const [start, end] = this._rangeSelectors(_start, _end)
+    return this._getRangeIntoRing(ring, start, end, opts)
+  }
+
+  /** @internal onBatch is called with the last key of every batch written. */
+  async _getRangeIntoRing(ring: RangeRing,
+      start: KeySelector<NativeValue>, end: KeySelector<NativeValue>,
+      opts: RangeRingOptions, onBatch?: (lastKey: Buffer, count: number) => void): Promise<number> {
+    let limit = opts.limit || 0
+    const reverse = opts.reverse || false
+    const batchBytes = opts.batchBytes || defaultBatchBytes
+    const batchRows = opts.batchRows || defaultBatchRows
+    // The byte and row limits keep every batch small enough to fit.
+    const maxChunk = ring._maxChunkBytes(batchBytes, batchRows)
+
+    ring._startProducing()
+    try {
+      let total = 0
+      for (let iter = 1; ; iter++) {
+        const rows = limit ? Math.min(limit, batchRows) : batchRows
+        if (iter === 1) this._recordRange(start, end, rows, batchBytes, StreamingMode.WantAll, reverse)
+        await ring._waitForSpace(maxChunk)
+        const {count, more, lastKey} = await this._tn.getRangeIntoRing(ring._bytes,
+          start.key, start.orEqual, start.offset,
+          end.key, end.orEqual, end.offset,
+          rows, batchBytes, StreamingMode.WantAll, iter, this.isSnapshot, reverse)
+        ring._published()
+        total += count
+
+        if (lastKey) {
+          if (!reverse) start = keySelector.firstGreaterThan(lastKey)
+          else end = keySelector.firstGreaterOrEqual(lastKey)
+          if (onBatch) onBatch(lastKey, count)
+        }
+        if (!more) break
+
+        if (limit) {
+          limit -= count
+          if (limit <= 0) break
+        }
+      }
+      return total
+    } finally {
+      ring._stopProducing()
+    }
+  }
+
   getRangeAllStartsWith(prefix: KeyIn | KeySelector<KeyIn>, opts?: RangeOptions) {
     return this.getRangeAll(prefix, undefined, opts)
   }
@@ -522,6 +1010,7 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
       end = this._keyEncoding.pack(_end)
     }
     // const _end = end == null ? strInc(_start) : this._keyEncoding.pack(end)
+    this._ctx.needsCommit = true
     this._tn.clearRange(start, end)
   }
 
@@ -532,6 +1021,9 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
 
   watch(key: KeyIn, opts?: WatchOptions): Watch {
     const throwAll = opts && opts.throwAllErrors
+    // Watches only start once the transaction commits.
+    this._ctx.needsCommit = true
+    this._ctx.hasWatches = true
     const watch = this._tn.watch(this._keyEncoding.pack(key), !throwAll)
     // Suppress the global unhandledRejection handler when a watch errors
     watch.promise.catch(doNothing)
@@ -547,10 +1039,12 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
   }
 
   addWriteConflictRange(start: KeyIn, end: KeyIn) {
+    this._ctx.needsCommit = true
     this._tn.addWriteConflictRange(this._keyEncoding.pack(start), this._keyEncoding.pack(end))
   }
   addWriteConflictKey(key: KeyIn) {
     const keyBuf = this._keyEncoding.pack(key)
+    this._ctx.needsCommit = true
     this._tn.addWriteConflictRange(keyBuf, strNext(keyBuf))
   }
 
@@ -597,13 +1091,14 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
   // **** Atomic operations
 
   atomicOpNative(opType: MutationType, key: NativeValue, oper: NativeValue) {
+    this._ctx.needsCommit = true
     this._tn.atomicOp(opType, key, oper)
   }
   atomicOpKB(opType: MutationType, key: KeyIn, oper: Buffer) {
-    this._tn.atomicOp(opType, this._keyEncoding.pack(key), oper)
+    this.atomicOpNative(opType, this._keyEncoding.pack(key), oper)
   }
   atomicOp(opType: MutationType, key: KeyIn, oper: ValIn) {
-    this._tn.atomicOp(opType, this._keyEncoding.pack(key), this._valueEncoding.pack(oper))
+    this.atomicOpNative(opType, this._keyEncoding.pack(key), this._valueEncoding.pack(oper))
   }
 
   /**
@@ -734,7 +1229,9 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
    * using setVersionstampedValue with tuples, just call get().
    */
   async getVersionstampPrefixedValue(key: KeyIn): Promise<{stamp: Buffer, value?: ValOut} | null> {
-    const val = await this._tn.get(this._keyEncoding.pack(key), this.isSnapshot)
+    const keyBuf = this._keyEncoding.pack(key)
+    this._recordKey(keyBuf)
+    const val = await this._tn.get(keyBuf, this.isSnapshot)
     return val == null ? null
       : {
         stamp: val.slice(0, 10),
@@ -753,6 +1250,19 @@ export default class Transaction<KeyIn = NativeValue, KeyOut = Buffer, ValIn = N
     return this._tn.getApproximateSize()
   }
 
+  /**
+   * Get an estimate of the number of bytes stored in the range [start, end).
+   * If end is omitted, start is used as a prefix. The estimate comes from
+   * the storage servers' byte samples, so it's accurate for big ranges but
+   * only rough for small ones.
+   */
+  getEstimatedRangeSizeBytes(start: KeyIn, end?: KeyIn): Promise<number> {
+    const range = end == null
+      ? this.subspace.packRange(start)
+      : {begin: this._keyEncoding.pack(start), end: this._keyEncoding.pack(end)}
+    return this._tn.getEstimatedRangeSizeBytes(range.begin, range.end)
+  }
+
   // This packs the value by prefixing the version stamp to the
   // valueEncoding's packed version of the value.
   // This is intended for use with getPackedVersionstampedValue.
@@ -0,0 +1,74 @@
+// Native transactions which have been reset after a doTn call finished, kept
+// for reuse by later doTn calls on the same database. This saves creating a
+// native transaction object (and waiting for the GC to destroy it) for every
+// transaction.
+//
+// There's one pool per native database, shared by all the Database objects
+// scoped from it.
+
+import {NativeDatabase, NativeTransaction} from './native'
+
+export type TransactionPoolStats = {
+  /** The number of reset transactions waiting in the pool */
+  size: number,
+  maxSize: number,
+
+  /** Transactions created because the pool was empty */
+  created: number,
+  /** Transactions taken from the pool */
+  reused: number,
+  /** Transactions returned to the pool */
+  released: number,
+  /** Transactions disposed because the pool was full */
+  discarded: number,
+}
+
+export default class TransactionPool {
+  private _free: NativeTransaction[] = []
+  private _stats: TransactionPoolStats
+
+  constructor(maxSize: number) {
+    this._stats = {size: 0, maxSize, created: 0, reused: 0, released: 0, discarded: 0}
+  }
+
+  take(db: NativeDatabase): NativeTransaction {
+    const tn = this._free.pop()
+    if (tn != null) {
+      this._stats.reused++
+      return tn
+    } else {
+      this._stats.created++
+      return db.createTransaction()
+    }
+  }
+
+  /**
+   * Reset the transaction and keep it for reuse if there's room. Otherwise
+   * it's disposed.
+   */
+  release(tn: NativeTransaction) {
+    if (this._free.length >= this._stats.maxSize) {
+      this._stats.discarded++
+      tn.dispose()
+      return
+    }
+    tn.reset()
+    this._free.push(tn)
+    this._stats.released++
+  }
+
+  setMaxSize(maxSize: number) {
+    this._stats.maxSize = maxSize
+    while (this._free.length > maxSize) this._free.pop()!.dispose()
+  }
+
+  /** Dispose all pooled transactions. */
+  clear() {
+    for (const tn of this._free) tn.dispose()
+    this._free.length = 0
+  }
+
+  getStats(): TransactionPoolStats {
+    return {...this._stats, size: this._free.length}
+  }
+}
@@ -25,8 +25,7 @@
 #include "transaction.h"
 #include "database.h"
 #include "options.h"
-
-static napi_ref cons_ref;
+#include "instance.h"
 
 static void finalize(napi_env env, void* database, void* finalize_hint) {
   fdb_database_destroy((FDB_database *)database);
@@ -34,7 +33,7 @@ static void finalize(napi_env env, void* database, void* finalize_hint) {
 
 MaybeValue newDatabase(napi_env env, FDBDatabase *database) {
   napi_value ctor;
-  NAPI_OK_OR_RETURN_MAYBE(env, napi_get_reference_value(env, cons_ref, &ctor));
+  NAPI_OK_OR_RETURN_MAYBE(env, napi_get_reference_value(env, getInstanceData(env)->database_cons, &ctor));
 
   napi_value obj;
   NAPI_OK_OR_RETURN_MAYBE(env, napi_new_instance(env, ctor, 0, NULL, &obj));
@@ -89,6 +88,6 @@ napi_status initDatabase(napi_env env) {
   NAPI_OK_OR_RETURN_STATUS(env, napi_define_class(env, "Database", NAPI_AUTO_LENGTH,
     newDatabase, NULL, sizeof(desc)/sizeof(desc[0]), desc, &constructor));
 
-  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &cons_ref));
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &getInstanceData(env)->database_cons));
   return napi_ok;
 }
@@ -1,8 +1,15 @@
 #include <cassert>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <uv.h>
 
 #include "utils.h"
 #include "future.h"
+#include "instance.h"
 
 // #include <cstdio>
 
@@ -13,119 +20,516 @@
 
 // #include "FdbError.h"
 
-static napi_threadsafe_function tsf;
-static int num_outstanding = 0;
-std::thread::id node_main_thread;
+// Resolved futures are handed from the FDB network thread to the node main
+// thread through a lock-free intrusive MPSC queue. The network thread pushes
+// the future's context and pokes a uv_async handle. The main thread then
+// drains the queue in batches, running all the callbacks for a batch inside a
+// single callback scope so we only pay for one wakeup and one microtask
+// checkpoint per batch rather than per future.
+//
+// This is Dmitry Vyukov's intrusive MPSC queue:
+// http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+struct CompletionNode {
+  std::atomic<CompletionNode*> next;
+  uint64_t enqueued_at; // uv_hrtime() when the network thread pushed the node.
+};
+
+struct CompletionQueue {
+  std::atomic<CompletionNode*> head; // Producers push here
+  CompletionNode* tail; // Only touched by the main thread
+  CompletionNode stub;
+
+  CompletionQueue() {
+    stub.next.store(NULL);
+    head.store(&stub);
+    tail = &stub;
+  }
+
+  void push(CompletionNode *node) {
+    node->next.store(NULL, std::memory_order_relaxed);
+    CompletionNode *prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Returns NULL if the queue is empty, or if a producer is midway through
+  // pushing. In that case the producer will signal the async handle again
+  // once its done.
+  CompletionNode *pop() {
+    CompletionNode *t = tail;
+    CompletionNode *next = t->next.load(std::memory_order_acquire);
+    if (t == &stub) {
+      if (next == NULL) return NULL;
+      tail = next;
+      t = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != NULL) {
+      tail = next;
+      return t;
+    }
+    if (t != head.load(std::memory_order_acquire)) return NULL;
+    push(&stub);
+    next = t->next.load(std::memory_order_acquire);
+    if (next != NULL) {
+      tail = next;
+      return t;
+    }
+    return NULL;
+  }
+};
+
+
+// Every pending future has a small context object, which is allocated when the
+// future is created and freed once its callback has run. Both of those happen
+// on the main thread (the network thread only passes contexts through the
+// completion queue), so rather than going through malloc for every read we
+// keep a freelist of fixed size slots for each context type. Slots are carved
+// out of slabs allocated on demand, up to a fixed capacity. Past that we fall
+// back to the heap and count a miss.
+struct CtxPool {
+  union Slot { Slot *next; };
+
+  static const uint32_t slab_slots = 256;
+  static const uint32_t max_slabs = 64;
+
+  const char *name;
+  size_t slot_size;
+  Slot *free_list;
+  uint32_t slabs;
+  char *slab_mem[max_slabs];
+
+  uint64_t in_use;
+  uint64_t high_water;
+  uint64_t misses;
+
+  CtxPool(const char *name, size_t size)
+    : name(name), slot_size(size), free_list(NULL), slabs(0), in_use(0), high_water(0), misses(0) {}
 
+  ~CtxPool() {
+    for (uint32_t i = 0; i < slabs; i++) free(slab_mem[i]);
+  }
+
+  void *alloc() {
+    if (UNLIKELY(free_list == NULL) && !grow()) {
+      misses++;
+      return NULL;
+    }
+    Slot *slot = free_list;
+    free_list = slot->next;
+    if (++in_use > high_water) high_water = in_use;
+    return slot;
+  }
+
+  void release(void *ptr) {
+    Slot *slot = (Slot *)ptr;
+    slot->next = free_list;
+    free_list = slot;
+    in_use--;
+  }
+
+  bool grow() {
+    if (slabs >= max_slabs) return false;
+    char *slab = (char *)malloc(slot_size * slab_slots);
+    if (slab == NULL) return false;
+    slab_mem[slabs++] = slab;
+    for (uint32_t i = 0; i < slab_slots; i++) {
+      Slot *slot = (Slot *)(slab + i * slot_size);
+      slot->next = free_list;
+      free_list = slot;
+    }
+    return true;
+  }
+};
+
+// Context types are numbered process-wide, so every env agrees on which
+// pool index belongs to which type. The pools themselves are per env.
+static const int max_pool_types = 8;
+static std::atomic<int> num_pool_types(0);
+
+// The network thread never blocks handing work to the main thread - the queue
+// is unbounded. (Previously we used a threadsafe function with a queue size of
+// 16 in blocking mode, so a slow JS tick would stall every transaction in the
+// process.) We still keep track of how often the queue backs up past that
+// point and for how long, since thats time the network thread would otherwise
+// have spent waiting on javascript.
+static const uint32_t backlog_threshold = 16;
+
+// Everything needed to deliver resolved futures to one napi_env. All fields
+// are only touched from that env's thread, except the queue and the atomics.
+struct FutureState {
+  napi_env env;
+  std::thread::id main_thread;
+  int num_outstanding;
+
+  CompletionQueue queue;
+  uv_async_t async_handle;
+  napi_async_context async_context;
+  napi_ref async_resource;
+
+  // Set once the env starts shutting down. Network thread callbacks count
+  // themselves in senders while they use async_handle, so we can wait for
+  // them before closing it.
+  std::atomic<bool> closing;
+  std::atomic<uint32_t> senders;
+
+  std::atomic<uint32_t> queue_depth;
+  std::atomic<uint64_t> backlog_since; // uv_hrtime() or 0 if not backlogged.
+  std::atomic<uint64_t> backlog_pushes;
+
+  // Maximum number of completions processed per wakeup. If more are waiting
+  // we yield back to the event loop and carry on in the next iteration.
+  uint32_t max_batch_size;
+
+  struct {
+    uint64_t completions;
+    uint64_t batches;
+    uint64_t max_batch;
+    uint64_t dispatch_latency_total_ns;
+    uint64_t dispatch_latency_max_ns;
+    uint64_t max_queue_depth;
+    uint64_t backlog_total_ns;
+    uint64_t ready_fast_path;
+  } stats;
+
+  CtxPool *pools[max_pool_types];
+
+  FutureState(napi_env env)
+    : env(env), main_thread(std::this_thread::get_id()), num_outstanding(0),
+      closing(false), senders(0), queue_depth(0), backlog_since(0), backlog_pushes(0),
+      max_batch_size(1024), stats(), pools() {}
+
+  ~FutureState() {
+    for (int i = 0; i < max_pool_types; i++) delete pools[i];
+  }
+};
+
+static FutureState *getFutureState(napi_env env) {
+  return getInstanceData(env)->futures;
+}
+
+// Each context type gets its own pool, sized for that type.
+template<class T> static CtxPool *poolFor(FutureState *state, const char *name) {
+  static const int index = num_pool_types.fetch_add(1);
+  assert(index < max_pool_types);
+
+  CtxPool *&pool = state->pools[index];
+  if (UNLIKELY(pool == NULL)) {
+    pool = new CtxPool(name, (sizeof(T) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1));
+  }
+  return pool;
+}
+
+template<class T> static T *allocCtx(FutureState *state, const char *name) {
+  // Contexts are freed without knowing their type (see trigger), so they
+  // can't have destructors.
+  static_assert(std::is_trivially_destructible<T>::value, "Context types must be trivially destructible");
+
+#ifndef FDB_NODE_NO_CTX_POOL
+  CtxPool *pool = poolFor<T>(state, name);
+  void *mem = pool->alloc();
+#else
+  // Only useful for benchmarking the pool against plain malloc.
+  CtxPool *pool = NULL;
+  void *mem = NULL;
+#endif
+  if (mem == NULL) {
+    mem = malloc(sizeof(T));
+    pool = NULL;
+  }
+  T *ctx = new (mem) T();
+  ctx->pool = pool;
+  ctx->state = state;
+  return ctx;
+}
+
+template<class CtxType> struct CtxBase: CompletionNode {
+  // The pool this context was allocated from, or NULL if it came from the heap.
+  CtxPool *pool;
 
-template<class CtxType> struct CtxBase {
   FDBFuture *future;
   napi_status (*fn)(napi_env, FDBFuture*, CtxType*);
 
-  // This is a little dirty, since we don't want to hold a reference to env.
-  // This is here so when fdb_future_set_callback calls the callback directly we
-  // can immediately call trigger.
-  napi_env env;
+  // The env which created the future. The network thread uses this to find
+  // the right completion queue, and if fdb_future_set_callback calls the
+  // callback directly we use it to trigger immediately.
+  FutureState *state;
 };
 
-static void trigger(napi_env env, napi_value _js_callback, void* _context, void* data) {
-  CtxBase<void>* ctx = static_cast<CtxBase<void>*>(data);
+// Called on the network thread. This must never block.
+static void enqueueCompletion(FutureState *state, CompletionNode *node) {
+  state->senders.fetch_add(1);
+  if (UNLIKELY(state->closing.load())) {
+    // The env is gone, so there's nobody to give the result to. The context
+    // (and the state) are leaked rather than touching the env's pools from
+    // this thread. This only happens if a worker exits with reads in flight.
+    state->senders.fetch_sub(1);
+    return;
+  }
 
-  if (env != NULL) {
-    --num_outstanding;
-    if (num_outstanding == 0) {
-      assert(0 == napi_unref_threadsafe_function(env, tsf));
-    }
+  node->enqueued_at = uv_hrtime();
 
-    napi_status status = ctx->fn(env, ctx->future, ctx);
-    throw_if_not_ok(env, status);
-    if (status == napi_pending_exception) {
-      // We don't have a stack here. For some reason, if an exception is thrown
-      // here it gets silently dropped.
-      napi_value err;
-      napi_get_and_clear_last_exception(env, &err);
-      napi_fatal_exception(env, err);
+  uint32_t depth = state->queue_depth.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (UNLIKELY(depth > backlog_threshold)) {
+    state->backlog_pushes.fetch_add(1, std::memory_order_relaxed);
+    uint64_t expected = 0;
+    state->backlog_since.compare_exchange_strong(expected, node->enqueued_at, std::memory_order_relaxed);
+  }
+
+  state->queue.push(node);
+  uv_async_send(&state->async_handle);
+  state->senders.fetch_sub(1);
+}
+
+template<class CtxType> static void freeCtx(CtxBase<CtxType> *ctx) {
+  if (ctx->pool) ctx->pool->release(ctx);
+  else free(ctx);
+}
+
+static void trigger(CtxBase<void>* ctx) {
+  FutureState *state = ctx->state;
+  napi_env env = state->env;
+  --state->num_outstanding;
+  if (state->num_outstanding == 0) uv_unref((uv_handle_t *)&state->async_handle);
+
+  napi_status status = ctx->fn(env, ctx->future, ctx);
+  throw_if_not_ok(env, status);
+  if (status == napi_pending_exception) {
+    // We don't have a stack here. For some reason, if an exception is thrown
+    // here it gets silently dropped.
+    napi_value err;
+    napi_get_and_clear_last_exception(env, &err);
+    napi_fatal_exception(env, err);
+  }
+  // assert(status == napi_ok);
+
+  if (ctx->future) fdb_future_destroy(ctx->future);
+  freeCtx(ctx);
+}
+
+static void drainQueue(uv_async_t *handle) {
+  FutureState *state = (FutureState *)handle->data;
+  napi_env env = state->env;
+
+  napi_handle_scope scope;
+  assert(napi_ok == napi_open_handle_scope(env, &scope));
+  napi_value resource;
+  assert(napi_ok == napi_get_reference_value(env, state->async_resource, &resource));
+  // Promises resolved by the callbacks below have their continuations run when
+  // the callback scope closes.
+  napi_callback_scope cb_scope;
+  assert(napi_ok == napi_open_callback_scope(env, resource, state->async_context, &cb_scope));
+
+  uint64_t now = uv_hrtime();
+  uint32_t depth = state->queue_depth.load(std::memory_order_relaxed);
+  if (depth > state->stats.max_queue_depth) state->stats.max_queue_depth = depth;
+
+  uint32_t count = 0;
+  CompletionNode *node;
+  while (count < state->max_batch_size && (node = state->queue.pop()) != NULL) {
+    count++;
+    depth = state->queue_depth.fetch_sub(1, std::memory_order_relaxed) - 1;
+    if (depth == backlog_threshold) {
+      uint64_t since = state->backlog_since.exchange(0, std::memory_order_relaxed);
+      if (since != 0) state->stats.backlog_total_ns += uv_hrtime() - since;
     }
-    // assert(status == napi_ok);
+
+    uint64_t latency = now > node->enqueued_at ? now - node->enqueued_at : 0;
+    state->stats.dispatch_latency_total_ns += latency;
+    if (latency > state->stats.dispatch_latency_max_ns) state->stats.dispatch_latency_max_ns = latency;
+
+    napi_handle_scope item_scope;
+    assert(napi_ok == napi_open_handle_scope(env, &item_scope));
+    trigger(static_cast<CtxBase<void>*>(node));
+    napi_close_handle_scope(env, item_scope);
   }
 
-  fdb_future_destroy(ctx->future);
-  delete ctx;
+  if (count > 0) {
+    state->stats.completions += count;
+    state->stats.batches++;
+    if (count > state->stats.max_batch) state->stats.max_batch = count;
+  }
+  // If we stopped early, come back for the rest on the next loop iteration.
+  if (count == state->max_batch_size) uv_async_send(&state->async_handle);
+
+  napi_close_callback_scope(env, cb_scope);
+  napi_close_handle_scope(env, scope);
 }
 
-napi_value unused_func;
+// Called when the env is torn down (eg when a worker thread exits).
+static void cleanupFutures(void *arg) {
+  FutureState *state = (FutureState *)arg;
 
-// napi_create_threadsafe_function requires that we pass a JS function argument.
-// The function is never called, but we still need to pass one anyway:
-// See https://github.com/nodejs/node/issues/27592
-napi_value unused(napi_env, napi_callback_info) {
-  assert(0);
-  return NULL;
+  state->closing.store(true);
+  // Wait for any network thread callbacks which didn't see closing in time.
+  // They only push to the queue (or copy one batch into a range ring), so
+  // this is quick.
+  while (state->senders.load() != 0) std::this_thread::yield();
+
+  if (state->num_outstanding == 0) {
+    uv_close((uv_handle_t *)&state->async_handle, [](uv_handle_t *handle) {
+      delete (FutureState *)handle->data;
+    });
+  } else {
+    // Futures still in flight will call back into the state later, so it has
+    // to outlive the env.
+    uv_close((uv_handle_t *)&state->async_handle, NULL);
+  }
 }
 
 napi_status initFuture(napi_env env) {
-  node_main_thread = std::this_thread::get_id();
-
-  char name[] = "unused_panic";
-  NAPI_OK_OR_RETURN_STATUS(env, napi_create_function(env, name, sizeof(name)-1, unused, NULL, &unused_func));
+  InstanceData *data = getInstanceData(env);
+  FutureState *state = new FutureState(env);
+
+  uv_loop_t *loop;
+  NAPI_OK_OR_RETURN_STATUS(env, napi_get_uv_event_loop(env, &loop));
+  if (uv_async_init(loop, &state->async_handle, drainQueue) != 0) {
+    delete state;
+    return napi_generic_failure;
+  }
+  state->async_handle.data = (void *)state;
+  // Workers each get their own loop. Only the main thread uses the default one.
+  data->is_main_thread = loop == uv_default_loop();
+  // Start the handle unreferenced, so node can exit cleanly if its never used.
+  uv_unref((uv_handle_t *)&state->async_handle);
+  data->futures = state;
+  NAPI_OK_OR_RETURN_STATUS(env, napi_add_env_cleanup_hook(env, cleanupFutures, state));
 
   char resource_name[] = "fdbfuture";
   napi_value str;
   NAPI_OK_OR_RETURN_STATUS(env, napi_create_string_utf8(env, resource_name, sizeof(resource_name)-1, &str));
-  NAPI_OK_OR_RETURN_STATUS(env,
-    napi_create_threadsafe_function(env, unused_func, NULL, str, 16 /*queue size*/, 1, NULL, NULL, NULL, trigger, &tsf)
-  );
-  // Start the threadsafe function unreferenced, so node can exit cleanly if its never used.
-  NAPI_OK_OR_RETURN_STATUS(env, napi_unref_threadsafe_function(env, tsf));
+  napi_value resource;
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_object(env, &resource));
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, resource, 1, &state->async_resource));
+  NAPI_OK_OR_RETURN_STATUS(env, napi_async_init(env, resource, str, &state->async_context));
+
+  return napi_ok;
+}
+
+void set_max_completion_batch(napi_env env, uint32_t size) {
+  getFutureState(env)->max_batch_size = size > 0 ? size : 1;
+}
 
+napi_status getFutureStats(napi_env env, napi_value obj) {
+  FutureState *state = getFutureState(env);
+  napi_value val;
+#define SET_STAT(target, name, expr) do {\
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_double(env, (double)(expr), &val));\
+  NAPI_OK_OR_RETURN_STATUS(env, napi_set_named_property(env, target, name, val));\
+} while (0)
+
+  SET_STAT(obj, "completions", state->stats.completions);
+  SET_STAT(obj, "completionBatches", state->stats.batches);
+  SET_STAT(obj, "maxCompletionBatch", state->stats.max_batch);
+  SET_STAT(obj, "dispatchLatencyTotalUs", state->stats.dispatch_latency_total_ns / 1000);
+  SET_STAT(obj, "dispatchLatencyMaxUs", state->stats.dispatch_latency_max_ns / 1000);
+  SET_STAT(obj, "outstandingFutures", state->num_outstanding);
+  SET_STAT(obj, "maxQueueDepth", state->stats.max_queue_depth);
+  SET_STAT(obj, "backlogPushes", state->backlog_pushes.load(std::memory_order_relaxed));
+  SET_STAT(obj, "backlogUs", state->stats.backlog_total_ns / 1000);
+  SET_STAT(obj, "readyFastPath", state->stats.ready_fast_path);
+
+  // ctxPools: {[type]: {inUse, highWater, capacity, misses}}
+  napi_value jsPools;
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_object(env, &jsPools));
+  for (int i = 0; i < max_pool_types; i++) {
+    CtxPool *pool = state->pools[i];
+    if (pool == NULL) continue;
+    napi_value jsPool;
+    NAPI_OK_OR_RETURN_STATUS(env, napi_create_object(env, &jsPool));
+    SET_STAT(jsPool, "inUse", pool->in_use);
+    SET_STAT(jsPool, "highWater", pool->high_water);
+    SET_STAT(jsPool, "capacity", pool->slabs * CtxPool::slab_slots);
+    SET_STAT(jsPool, "misses", pool->misses);
+    NAPI_OK_OR_RETURN_STATUS(env, napi_set_named_property(env, jsPools, pool->name, jsPool));
+  }
+  NAPI_OK_OR_RETURN_STATUS(env, napi_set_named_property(env, obj, "ctxPools", jsPools));
+#undef SET_STAT
   return napi_ok;
 }
 
-// unused cleanup.
-void closeFuture(napi_env env) {
-  napi_release_threadsafe_function(tsf, napi_tsfn_abort);
+// Bump the outstanding count for a new future. This stops node from exiting
+// until the future has resolved.
+static void addOutstanding(FutureState *state) {
+  if (state->num_outstanding == 0) uv_ref((uv_handle_t *)&state->async_handle);
+  state->num_outstanding++;
 }
 
+// Called on whichever thread resolves the future.
+static void onFutureResolved(CtxBase<void> *ctx) {
+  // Foundationdb will sometimes resolve this callback in the main thread. In
+  // that case we can just trigger immediately - see
+  // https://github.com/josephg/node-foundationdb/issues/41 .
+  if (ctx->state->main_thread == std::this_thread::get_id()) {
+    trigger(ctx);
+  } else {
+    enqueueCompletion(ctx->state, ctx);
+  }
+}
 
 template<class CtxType> static napi_status resolveFutureInMainLoop(napi_env env, FDBFuture *f, CtxType* ctx, napi_status (*fn)(napi_env env, FDBFuture *f, CtxType*)) {
   ctx->future = f;
   ctx->fn = fn;
-  ctx->env = env;
 
-  // Prevent node from closing until the future has resolved.
-  if (num_outstanding == 0) {
-    NAPI_OK_OR_RETURN_STATUS(env, napi_ref_threadsafe_function(env, tsf));
-  }
-  num_outstanding++;
+  addOutstanding(ctx->state);
 
   assert(0 == fdb_future_set_callback(f, [](FDBFuture *f, void *_ctx) {
     // raise(SIGTRAP);
-    CtxType* ctx = static_cast<CtxType*>(_ctx);
-
-    // Foundationdb will sometimes resolve this callback in the main thread. In
-    // that case, we can't block because doing so could cause a deadlock - see
-    // https://github.com/josephg/node-foundationdb/issues/41 .
-    if (node_main_thread == std::this_thread::get_id()) {
-      // Trigger immediately without going via threadsafe_function
-      trigger(ctx->env, NULL, NULL, ctx);
-    } else {
-      ctx->env = NULL;
-      assert(napi_ok == napi_call_threadsafe_function(tsf, ctx, napi_tsfn_blocking));
-    }
+    onFutureResolved((CtxBase<void>*)static_cast<CtxType*>(_ctx));
   }, ctx));
 
   return napi_ok;
 }
 
+// Settle a promise with the result of an extraction function.
+static napi_status settleDeferred(napi_env env, napi_deferred deferred, MaybeValue value, fdb_error_t errcode) {
+  if (errcode != 0) {
+    napi_value err;
+    NAPI_OK_OR_RETURN_STATUS(env, wrap_fdb_error(env, errcode, &err));
+    NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
+  } else if (value.status != napi_ok) {
+    napi_value err;
+    NAPI_OK_OR_RETURN_STATUS(env, napi_get_and_clear_last_exception(env, &err));
+    NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
+  } else {
+    if (value.value == NULL) NAPI_OK_OR_RETURN_STATUS(env, napi_get_null(env, &value.value));
+    NAPI_OK_OR_RETURN_STATUS(env, napi_resolve_deferred(env, deferred, value.value));
+  }
+  return napi_ok;
+}
+
+void countReadyFastPath(napi_env env) {
+  getFutureState(env)->stats.ready_fast_path++;
+}
 
 MaybeValue fdbFutureToJSPromise(napi_env env, FDBFuture *f, ExtractValueFn *extractFn) {
+  if (fdb_future_is_ready(f)) {
+    // Reads served from the transaction's read-your-writes cache are often
+    // ready straight away. There's no need to go through the completion
+    // queue (or allocate a context) for those - resolve the promise now.
+    countReadyFastPath(env);
+
+    napi_deferred deferred;
+    napi_value promise;
+    napi_status status = napi_create_promise(env, &deferred, &promise);
+    if (status != napi_ok) {
+      fdb_future_destroy(f);
+      return wrap_err(throw_if_not_ok(env, status));
+    }
+
+    fdb_error_t errcode = 0;
+    MaybeValue value = extractFn(env, &f, &errcode);
+    if (f) fdb_future_destroy(f);
+    NAPI_OK_OR_RETURN_MAYBE(env, settleDeferred(env, deferred, value, errcode));
+    return wrap_ok(promise);
+  }
+
   // Using inheritance here because Persistent doesn't seem to like being
   // copied, and this avoids another allocation & indirection.
   struct Ctx: CtxBase<Ctx> {
     napi_deferred deferred;
     ExtractValueFn *extractFn;
   };
-  Ctx *ctx = new Ctx; // Ownership passed to resolveFutureInMainLoop.
+  Ctx *ctx = allocCtx<Ctx>(getFutureState(env), "promise"); // Ownership passed to resolveFutureInMainLoop.
   ctx->extractFn = extractFn;
 
   napi_value promise;
@@ -133,33 +537,17 @@ MaybeValue fdbFutureToJSPromise(napi_env env, FDBFuture *f, ExtractValueFn *extr
 
   napi_status status = resolveFutureInMainLoop<Ctx>(env, f, ctx, [](napi_env env, FDBFuture *f, Ctx *ctx) {
     fdb_error_t errcode = 0;
-    MaybeValue value = ctx->extractFn(env, f, &errcode);
-
-    napi_deferred deferred = ctx->deferred;
-    // delete ctx;
-
-    if (errcode != 0) {
-      napi_value err;
-      NAPI_OK_OR_RETURN_STATUS(env, wrap_fdb_error(env, errcode, &err));
-      NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
-    } else if (value.status != napi_ok) {
-      napi_value err;
-      NAPI_OK_OR_RETURN_STATUS(env, napi_get_and_clear_last_exception(env, &err));
-      NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
-    } else {
-      if (value.value == NULL) NAPI_OK_OR_RETURN_STATUS(env, napi_get_null(env, &value.value));
-      NAPI_OK_OR_RETURN_STATUS(env, napi_resolve_deferred(env, deferred, value.value));
-    }
+    MaybeValue value = ctx->extractFn(env, &ctx->future, &errcode);
 
     // Needed to work around a bug where the promise doesn't actually resolve.
     // v8::Isolate *isolate = v8::Isolate::GetCurrent();
     // isolate->RunMicrotasks();
-    return napi_ok;
+    return settleDeferred(env, ctx->deferred, value, errcode);
   });
 
   if (status != napi_ok) {
     napi_resolve_deferred(env, ctx->deferred, NULL); // free the promise
-    delete ctx;
+    freeCtx(ctx);
     return wrap_err(status);
   } else return wrap_ok(promise);
 }
@@ -169,14 +557,14 @@ MaybeValue fdbFutureToCallback(napi_env env, FDBFuture *f, napi_value cbFunc, Ex
     napi_ref cbFunc;
     ExtractValueFn *extractFn;
   };
-  Ctx *ctx = new Ctx;
+  Ctx *ctx = allocCtx<Ctx>(getFutureState(env), "callback");
 
   NAPI_OK_OR_RETURN_MAYBE(env, napi_create_reference(env, cbFunc, 1, &ctx->cbFunc));
   ctx->extractFn = extractFn;
 
   napi_status status = resolveFutureInMainLoop<Ctx>(env, f, ctx, [](napi_env env, FDBFuture *f, Ctx *ctx) {
     fdb_error_t errcode = 0;
-    MaybeValue value = ctx->extractFn(env, f, &errcode);
+    MaybeValue value = ctx->extractFn(env, &ctx->future, &errcode);
 
     napi_value callback;
     NAPI_OK_OR_RETURN_STATUS(env, napi_get_reference_value(env, ctx->cbFunc, &callback));
@@ -203,6 +591,26 @@ MaybeValue fdbFutureToCallback(napi_env env, FDBFuture *f, napi_value cbFunc, Ex
   return wrap_err(status);
 }
 
+bool blockingAllowed(napi_env env) {
+  if (UNLIKELY(getInstanceData(env)->is_main_thread)) {
+    throw_if_not_ok(env, napi_throw_error(env, NULL, "Blocking calls can only be used from worker threads"));
+    return false;
+  }
+  return true;
+}
+
+MaybeValue futureToJSBlocking(napi_env env, FDBFuture *f, ExtractValueFn *extractFn) {
+  fdb_error_t errcode = fdb_future_block_until_ready(f);
+  MaybeValue value = wrap_null();
+  if (errcode == 0) value = extractFn(env, &f, &errcode);
+  if (f) fdb_future_destroy(f);
+  if (errcode != 0) {
+    throw_fdb_error(env, errcode);
+    return wrap_err(napi_pending_exception);
+  }
+  return value;
+}
+
 MaybeValue futureToJS(napi_env env, FDBFuture *f, napi_value cbOrNull, ExtractValueFn *extractFn) {
   napi_valuetype type;
   NAPI_OK_OR_RETURN_MAYBE(env, typeof_wrap(env, cbOrNull, &type));
@@ -215,6 +623,115 @@ MaybeValue futureToJS(napi_env env, FDBFuture *f, napi_value cbOrNull, ExtractVa
   }
 }
 
+napi_status futureWhenReady(napi_env env, FDBFuture *f, FutureReadyFn *readyFn, void *data, FutureResolvedHook *onResolved) {
+  struct Ctx: CtxBase<Ctx> {
+    FutureReadyFn *readyFn;
+    FutureResolvedHook *onResolved;
+    void *data;
+  };
+  Ctx *ctx = allocCtx<Ctx>(getFutureState(env), "notify");
+  ctx->readyFn = readyFn;
+  ctx->onResolved = onResolved;
+  ctx->data = data;
+
+  ctx->future = f;
+  ctx->fn = [](napi_env env, FDBFuture *f, Ctx *ctx) {
+    // The caller still owns the future, so trigger() mustn't destroy it.
+    ctx->future = NULL;
+    return ctx->readyFn(env, f, ctx->data);
+  };
+
+  addOutstanding(ctx->state);
+
+  fdb_error_t err = fdb_future_set_callback(f, [](FDBFuture *f, void *_ctx) {
+    Ctx *ctx = static_cast<Ctx*>(_ctx);
+    if (ctx->onResolved) {
+      // Once the env is closing nobody will look at the results, and the
+      // memory the hook writes to may be gone. Registering as a sender first
+      // makes cleanupFutures wait for the hook to finish.
+      FutureState *state = ctx->state;
+      state->senders.fetch_add(1);
+      if (!state->closing.load()) ctx->onResolved(f, ctx->data);
+      state->senders.fetch_sub(1);
+    }
+    onFutureResolved((CtxBase<void>*)ctx);
+  }, ctx);
+  assert(err == 0);
+  (void)err;
+
+  return napi_ok;
+}
+
+MaybeValue futuresToJSArray(napi_env env, FDBFuture **futures, uint32_t count, ExtractValueFn *extractFn) {
+  // One context tracks the whole group. Each future's callback counts down
+  // remaining, and only the last one queues the context for the main thread.
+  struct Ctx: CtxBase<Ctx> {
+    napi_deferred deferred;
+    ExtractValueFn *extractFn;
+    std::atomic<uint32_t> remaining;
+    uint32_t count;
+    FDBFuture *futures[1]; // Actually [count].
+  };
+
+  // These are variable sized, so they don't come from a pool.
+  void *mem = malloc(sizeof(Ctx) + (count > 0 ? count - 1 : 0) * sizeof(FDBFuture *));
+  if (UNLIKELY(mem == NULL)) abort();
+  Ctx *ctx = new (mem) Ctx;
+  ctx->pool = NULL;
+  ctx->state = getFutureState(env);
+  ctx->future = NULL; // The futures are destroyed below, not by trigger().
+  ctx->fn = [](napi_env env, FDBFuture *, Ctx *ctx) {
+    fdb_error_t errcode = 0;
+    napi_status status = napi_ok;
+    napi_value result = NULL;
+    if (napi_create_array_with_length(env, ctx->count, &result) != napi_ok) status = napi_generic_failure;
+
+    for (uint32_t i = 0; i < ctx->count; i++) {
+      if (errcode == 0 && status == napi_ok) {
+        MaybeValue value = ctx->extractFn(env, &ctx->futures[i], &errcode);
+        if (value.status != napi_ok) status = value.status;
+        else if (errcode == 0 && value.value != NULL) status = napi_set_element(env, result, i, value.value);
+      }
+      // Once we have an error the remaining futures are just cleaned up.
+      if (ctx->futures[i]) fdb_future_destroy(ctx->futures[i]);
+    }
+
+    return settleDeferred(env, ctx->deferred, {status, result}, errcode);
+  };
+  ctx->extractFn = extractFn;
+  ctx->count = count;
+  // +1 so the group can't complete until we've finished setting callbacks.
+  ctx->remaining.store(count + 1);
+  memcpy(ctx->futures, futures, count * sizeof(FDBFuture *));
+
+  napi_value promise;
+  napi_status status = napi_create_promise(env, &ctx->deferred, &promise);
+  if (status != napi_ok) {
+    for (uint32_t i = 0; i < count; i++) fdb_future_destroy(futures[i]);
+    free(ctx);
+    return wrap_err(status);
+  }
+
+  addOutstanding(ctx->state);
+
+  FDBCallback onReady = [](FDBFuture *f, void *_ctx) {
+    Ctx *ctx = static_cast<Ctx*>(_ctx);
+    if (ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    onFutureResolved((CtxBase<void>*)ctx);
+  };
+
+  for (uint32_t i = 0; i < count; i++) {
+    fdb_error_t err = fdb_future_set_callback(futures[i], onReady, ctx);
+    assert(err == 0);
+    (void)err;
+  }
+  // Drop our own count. If every future had already resolved this resolves
+  // the promise immediately.
+  onReady(NULL, ctx);
+
+  return wrap_ok(promise);
+}
+
 
 // *** Watch
 
@@ -230,8 +747,6 @@ MaybeValue futureToJS(napi_env env, FDBFuture *f, napi_value cbOrNull, ExtractVa
 
 // TODO: Using classes here is overwraught.
 
-static napi_ref watch_cons_ref;
-
 static napi_value cancel(napi_env env, napi_callback_info info) {
   // If the future has already been cancelled, napi_unwrap returns an invalid argument error.
   napi_value obj;
@@ -265,7 +780,7 @@ napi_status initWatch(napi_env env) {
   NAPI_OK_OR_RETURN_STATUS(env, napi_define_class(env, "Watch", NAPI_AUTO_LENGTH,
     empty, NULL, sizeof(desc)/sizeof(desc[0]), desc, &constructor));
 
-  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &watch_cons_ref));
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &getInstanceData(env)->watch_cons));
   return napi_ok;
 }
 
@@ -278,13 +793,13 @@ MaybeValue watchFuture(napi_env env, FDBFuture *f, bool ignoreStandardErrors) {
     napi_deferred deferred;
     bool ignoreStandardErrors;
   };
-  Ctx *ctx = new Ctx;
+  Ctx *ctx = allocCtx<Ctx>(getFutureState(env), "watch");
 
   napi_value promise;
   NAPI_OK_OR_RETURN_MAYBE(env, napi_create_promise(env, &ctx->deferred, &promise));
 
   napi_value ctor;
-  NAPI_OK_OR_RETURN_MAYBE(env, napi_get_reference_value(env, watch_cons_ref, &ctor));
+  NAPI_OK_OR_RETURN_MAYBE(env, napi_get_reference_value(env, getInstanceData(env)->watch_cons, &ctor));
 
   napi_value jsWatch;
   NAPI_OK_OR_RETURN_MAYBE(env, napi_new_instance(env, ctor, 0, NULL, &jsWatch));
@@ -346,7 +861,7 @@ MaybeValue watchFuture(napi_env env, FDBFuture *f, bool ignoreStandardErrors) {
   if (status != napi_ok) {
     napi_resolve_deferred(env, ctx->deferred, NULL);
     napi_reference_unref(env, ctx->jsWatch, NULL);
-    delete ctx;
+    freeCtx(ctx);
     return wrap_err(status);
   } else return wrap_ok(jsWatch);
 }
@@ -7,13 +7,51 @@
 
 napi_status initFuture(napi_env env);
 
-typedef MaybeValue ExtractValueFn(napi_env env, FDBFuture* f, fdb_error_t* errOut);
+// Set the maximum number of resolved futures processed per event loop wakeup.
+void set_max_completion_batch(napi_env env, uint32_t size);
+
+// Add counters describing future dispatch to the passed JS object.
+napi_status getFutureStats(napi_env env, napi_value obj);
+
+// Count a future which was already resolved when it was issued, and so was
+// handled without going through the completion queue.
+void countReadyFastPath(napi_env env);
+
+// Extraction functions are called on the main thread once the future has
+// resolved. The future is destroyed after the function returns, unless the
+// function takes ownership of it by setting *f to NULL. (This is used to hand
+// the future's memory directly to javascript without copying it.)
+typedef MaybeValue ExtractValueFn(napi_env env, FDBFuture** f, fdb_error_t* errOut);
 
 // v8::Local<v8::Promise> fdbFutureToJSPromise(FDBFuture* f, ExtractValueFn* extractValueFn);
 // void fdbFutureToCallback(FDBFuture *f, v8::Local<v8::Function> cbFunc, ExtractValueFn *extractFn);
 
 MaybeValue futureToJS(napi_env env, FDBFuture *f, napi_value cbOrNull, ExtractValueFn *extractFn);
 
+// Blocking calls wait for their future on the calling thread, and return the
+// value directly (or throw). This would stall the event loop, so they're only
+// allowed in worker threads. blockingAllowed throws and returns false if
+// called from the main thread.
+bool blockingAllowed(napi_env env);
+// Takes ownership of the future.
+MaybeValue futureToJSBlocking(napi_env env, FDBFuture *f, ExtractValueFn *extractFn);
+
+// Call readyFn(env, f, data) on the main thread once f resolves. Unlike
+// futureToJS this doesn't take ownership of the future. This is for native
+// objects which manage their own futures.
+//
+// If onResolved is passed, it's called with the same data on whichever thread
+// resolves the future (usually the FDB network thread) before readyFn is
+// queued. It must never block, and can't touch javascript.
+typedef napi_status FutureReadyFn(napi_env env, FDBFuture *f, void *data);
+typedef void FutureResolvedHook(FDBFuture *f, void *data);
+napi_status futureWhenReady(napi_env env, FDBFuture *f, FutureReadyFn *readyFn, void *data, FutureResolvedHook *onResolved = NULL);
+
+// Returns a promise which resolves to an array of all the futures' values
+// once the last of them resolves, or rejects with the first error. Takes
+// ownership of the futures (but not the array).
+MaybeValue futuresToJSArray(napi_env env, FDBFuture **futures, uint32_t count, ExtractValueFn *extractFn);
+
 napi_status initWatch(napi_env env);
 MaybeValue watchFuture(napi_env env, FDBFuture *f, bool ignoreStandardErrors);
 
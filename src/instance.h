@@ -0,0 +1,45 @@
+// Per-env state for the module.
+//
+// The module can be loaded into several napi_envs at once (the main thread
+// and any number of worker_threads). Each env gets its own constructors,
+// completion queue and so on, stored here as the env's instance data. The
+// FDB network thread is shared by all of them.
+
+#ifndef FDB_NODE_INSTANCE_H
+#define FDB_NODE_INSTANCE_H
+
+#include "utils.h"
+
+struct FutureState; // See future.cpp.
+
+struct InstanceData {
+  napi_ref database_cons;
+  napi_ref transaction_cons;
+  napi_ref iterator_cons;
+  napi_ref watch_cons;
+
+  // The exports object. The JS code attaches the FDBError class to it after
+  // the module is loaded.
+  napi_ref exports;
+
+  // Values returned from get() which are at least this big are backed by the
+  // future's memory instead of being copied. 0 disables zero-copy reads.
+  size_t zero_copy_threshold;
+
+  // True if this env has started (and not yet released) the network thread.
+  bool uses_network;
+
+  // True if this env runs on node's main thread (rather than in a worker).
+  // Blocking calls are refused there, since they'd stall the whole process.
+  bool is_main_thread;
+
+  FutureState *futures;
+};
+
+inline InstanceData *getInstanceData(napi_env env) {
+  void *data = NULL;
+  napi_get_instance_data(env, &data);
+  return (InstanceData *)data;
+}
+
+#endif
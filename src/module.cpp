@@ -22,6 +22,7 @@
  */
 
 #include <cassert>
+#include <mutex>
 
 #include "utils.h"
 
@@ -37,14 +38,24 @@
 #include "transaction.h"
 #include "error.h"
 #include "options.h"
+#include "instance.h"
 
 using namespace std;
 
 
+// The module may be loaded by several envs (worker threads) at once, but
+// there's only one FDB client and network thread per process. This state is
+// shared between all envs, and guarded by network_lock.
+static std::mutex network_lock;
 static uv_thread_t fdbThread;
 
 static bool networkStarted = false;
 static int32_t previousApiVersion = 0;
+// The number of envs which have started the network and not yet let go of it.
+static int networkUsers = 0;
+// Set if the main thread asked to stop the network while workers were still
+// using it. The last of them to let go stops it.
+static bool stopRequested = false;
 
 
 static napi_value setAPIVersion(napi_env env, napi_callback_info info) {
@@ -52,7 +63,8 @@ static napi_value setAPIVersion(napi_env env, napi_callback_info info) {
 
   int32_t apiVersion;
   NAPI_OK_OR_RETURN_NULL(env, napi_get_value_int32(env, args[0], &apiVersion));
-  
+
+  std::lock_guard<std::mutex> guard(network_lock);
   if (previousApiVersion != 0) {
     if (apiVersion != previousApiVersion) {
       FDB_OK_OR_RETURN_NULL(env, fdb_select_api_version(apiVersion));
@@ -71,7 +83,8 @@ static napi_value setAPIVersionImpl(napi_env env, napi_callback_info info) {
   NAPI_OK_OR_RETURN_NULL(env, napi_get_value_int32(env, args[0], &apiVersion));
   int32_t headerVersion;
   NAPI_OK_OR_RETURN_NULL(env, napi_get_value_int32(env, args[1], &headerVersion));
-  
+
+  std::lock_guard<std::mutex> guard(network_lock);
   if (previousApiVersion != 0) {
     if (apiVersion != previousApiVersion) {
       FDB_OK_OR_RETURN_NULL(env, fdb_select_api_version_impl(apiVersion, headerVersion));
@@ -90,15 +103,6 @@ static void networkThread(void *arg) {
   }
 }
 
-static fdb_error_t runNetwork() {
-  fdb_error_t errorCode = fdb_setup_network();
-
-  if(errorCode != 0) return errorCode;
-
-  assert(0 == uv_thread_create(&fdbThread, networkThread, NULL));  // FIXME: Handle errors here gracefully
-  return 0;
-}
-
 // Added in 610. This just creates a database; no muss no fuss.
 static napi_value createDatabase(napi_env env, napi_callback_info info) {
   // The only argument here is an optional string cluster_file_path.
@@ -130,32 +134,110 @@ static napi_value createDatabase(napi_env env, napi_callback_info info) {
 }
 
 static napi_value setNetworkOption(napi_env env, napi_callback_info info) {
+  std::lock_guard<std::mutex> guard(network_lock);
   set_option_wrapped(env, NULL, OptNetwork, info);
   return NULL;
 }
 
 static napi_value startNetwork(napi_env env, napi_callback_info info) {
+  InstanceData *data = getInstanceData(env);
+  std::lock_guard<std::mutex> guard(network_lock);
   if(!networkStarted) {
+    // FDB can only set up the network once per process. If it has already
+    // been stopped this throws, rather than leaving the env with futures
+    // which never resolve.
+    FDB_OK_OR_RETURN_NULL(env, fdb_setup_network());
+
+    int err = uv_thread_create(&fdbThread, networkThread, NULL);
+    if (err != 0) {
+      napi_throw_error(env, NULL, uv_strerror(err));
+      return NULL;
+    }
     networkStarted = true;
-    runNetwork();
+  }
+
+  if (!data->uses_network) {
+    data->uses_network = true;
+    networkUsers++;
   }
   return NULL;
 }
 
-static napi_value stopNetwork(napi_env env, napi_callback_info info) {
-  if (!networkStarted) return NULL;
+// Stop the network thread and wait for it to exit. Call with network_lock
+// held.
+static fdb_error_t stopNetworkLocked() {
+  fdb_error_t err = fdb_stop_network();
+  if (err != 0) return err;
 
-  FDB_OK_OR_RETURN_NULL(env, fdb_stop_network());
+  int joinErr = uv_thread_join(&fdbThread);
+  if (joinErr != 0) {
+    fprintf(stderr, "Could not join the FoundationDB network thread: %s\n", uv_strerror(joinErr));
+  }
+  networkStarted = false;
+  return 0;
+}
 
-  assert(0 == uv_thread_join(&fdbThread));
+// Release this env's hold on the network. A worker letting go never stops
+// the network by itself: it can't be started again once it has stopped, so
+// it must be left running for whoever opens a database next. The exception
+// is when the main thread has already asked for it to stop.
+static void releaseNetwork(InstanceData *data) {
+  std::lock_guard<std::mutex> guard(network_lock);
+  if (!data->uses_network) return;
+  data->uses_network = false;
+  if (--networkUsers == 0 && stopRequested && networkStarted) stopNetworkLocked();
+}
 
-  networkStarted = false;
+// Called explicitly via stopNetworkSync, or when the process exits. Only the
+// main thread stops the network - in a worker this just lets go. If workers
+// are still using the network, it's stopped once the last of them lets go.
+static napi_value stopNetwork(napi_env env, napi_callback_info info) {
+  InstanceData *data = getInstanceData(env);
+  releaseNetwork(data);
+  if (!data->is_main_thread) return NULL;
+
+  std::lock_guard<std::mutex> guard(network_lock);
+  if (!networkStarted) return NULL;
+  if (networkUsers > 0) {
+    stopRequested = true;
+    return NULL;
+  }
+
+  FDB_OK_OR_RETURN_NULL(env, stopNetworkLocked());
 
   //This line forces garbage collection.  Useful for doing valgrind tests
   //while(!V8::IdleNotification());
   return NULL;
 }
 
+// setZeroCopyThreshold(bytes). 0 disables zero-copy reads.
+static napi_value setZeroCopyThreshold(napi_env env, napi_callback_info info) {
+  GET_ARGS(env, info, args, 1);
+
+  uint32_t bytes;
+  NAPI_OK_OR_RETURN_NULL(env, napi_get_value_uint32(env, args[0], &bytes));
+  set_zero_copy_threshold(env, bytes);
+  return NULL;
+}
+
+// setMaxCompletionBatch(count)
+static napi_value setMaxCompletionBatch(napi_env env, napi_callback_info info) {
+  GET_ARGS(env, info, args, 1);
+
+  uint32_t count;
+  NAPI_OK_OR_RETURN_NULL(env, napi_get_value_uint32(env, args[0], &count));
+  set_max_completion_batch(env, count);
+  return NULL;
+}
+
+// getStats() -> {...counters}
+static napi_value getStats(napi_env env, napi_callback_info info) {
+  napi_value result;
+  NAPI_OK_OR_RETURN_NULL(env, napi_create_object(env, &result));
+  NAPI_OK_OR_RETURN_NULL(env, getFutureStats(env, result));
+  return result;
+}
+
 // (test, code) -> bool.
 static napi_value errorPredicate(napi_env env, napi_callback_info info) {
   size_t argc = 2;
@@ -176,6 +258,17 @@ static napi_value errorPredicate(napi_env env, napi_callback_info info) {
 }
 
 static napi_value init(napi_env env, napi_value exports) {
+  InstanceData *data = (InstanceData *)calloc(1, sizeof(InstanceData));
+  if (data == NULL) return NULL;
+  NAPI_OK_OR_RETURN_NULL(env, napi_set_instance_data(env, data, [](napi_env env, void *data, void *hint) {
+    free(data);
+  }, NULL));
+  // If the env goes away (eg a worker thread exits) without calling
+  // stopNetwork, let go of the network on its behalf.
+  NAPI_OK_OR_RETURN_NULL(env, napi_add_env_cleanup_hook(env, [](void *data) {
+    releaseNetwork((InstanceData *)data);
+  }, data));
+
   NAPI_OK_OR_RETURN_NULL(env, initFuture(env));
   NAPI_OK_OR_RETURN_NULL(env, initDatabase(env));
   NAPI_OK_OR_RETURN_NULL(env, initTransaction(env));
@@ -197,6 +290,10 @@ static napi_value init(napi_env env, napi_value exports) {
 
     FN_DEF(errorPredicate),
 
+    FN_DEF(setZeroCopyThreshold),
+    FN_DEF(setMaxCompletionBatch),
+    FN_DEF(getStats),
+
     // export type: 'napi' to differentiate it from the nan-based code at runtime.
     {"type", NULL, NULL, NULL, NULL, napi, napi_default, NULL},
   };
@@ -204,4 +301,6 @@ static napi_value init(napi_env env, napi_value exports) {
   return NULL;
 }
 
-NAPI_MODULE(NODE_GYP_MODULE_NAME, init);
+NAPI_MODULE_INIT() {
+  return init(env, exports);
+}
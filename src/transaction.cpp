@@ -21,15 +21,21 @@
  * THE SOFTWARE.
  */
 
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 // #include <cstdio>
 #include <cassert>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "options.h"
 #include "transaction.h"
 // #include "FdbError.h"
 
 #include "future.h"
+#include "instance.h"
 
 // using namespace v8;
 using namespace std;
@@ -38,75 +44,281 @@ using namespace std;
 #define TRY(expr) NAPI_OK_OR_RETURN_MAYBE(env, (expr))
 #define TRY_V(expr) NAPI_OK_OR_RETURN_NULL(env, (expr))
 
-static napi_ref cons_ref;
-
 
 static napi_value empty(napi_env env, napi_callback_info info) {
   return NULL;
 }
 
-static void finalize(napi_env env, void* tn, void* finalize_hint) {
-  fdb_transaction_destroy((FDB_transaction *)tn);
+// Reads started by prefetch() / prefetchRange() which haven't been claimed
+// yet. A prefetched key is claimed by the next get() or getMany() of that key,
+// which uses the prefetched future instead of starting a new read. Range
+// prefetches are never claimed - they just fill the transaction's read cache,
+// and are kept here so they can be destroyed when the transaction resets.
+//
+// A read only sees writes made before it started, so writing a key drops its
+// prefetched read.
+struct Prefetched {
+  struct Read {
+    FDBFuture *f;
+    bool snapshot;
+  };
+  unordered_map<string, Read> keys;
+  vector<FDBFuture *> ranges;
+};
+
+// The object wrapped by javascript Transaction objects.
+//
+// V8 can't see the memory held by the native transaction (mostly its write
+// and read-your-writes caches), so it has no reason to collect transactions
+// which have filled them. We estimate that memory from the mutations we pass
+// in and report it with napi_adjust_external_memory.
+struct TransactionWrap {
+  FDBTransaction *tr; // NULL once the transaction has been disposed.
+
+  // Bytes reported to V8, and bytes we've added since then. Small writes are
+  // reported in chunks to save calls into V8.
+  int64_t reported_bytes, pending_bytes;
+
+  // NULL until something is prefetched.
+  Prefetched *prefetched;
+
+  // Bumped by reset(). A reset transaction may be reused for something else
+  // entirely (see lib/transactionPool.ts), so range iterators started before
+  // the reset must stop.
+  uint32_t resets;
+};
+
+// Drop all unclaimed prefetched reads. This must be called whenever the
+// native transaction is reset (including by onError) or destroyed.
+static void clearPrefetched(TransactionWrap *tn) {
+  Prefetched *p = tn->prefetched;
+  if (LIKELY(p == NULL)) return;
+  for (auto &entry : p->keys) fdb_future_destroy(entry.second.f);
+  for (FDBFuture *f : p->ranges) fdb_future_destroy(f);
+  delete p;
+  tn->prefetched = NULL;
+}
+
+// Take the prefetched read of key, if there is one.
+static FDBFuture *claimPrefetched(TransactionWrap *tn, const uint8_t *key, size_t len, bool snapshot) {
+  Prefetched *p = tn->prefetched;
+  if (LIKELY(p == NULL)) return NULL;
+  auto it = p->keys.find(string((const char *)key, len));
+  if (it == p->keys.end()) return NULL;
+
+  if (it->second.snapshot && !snapshot) {
+    // A non-snapshot read is a snapshot read plus a read conflict on the key.
+    string end(it->first);
+    end.push_back('\0');
+    if (fdb_transaction_add_conflict_range(tn->tr, key, (int)len,
+        (const uint8_t *)end.data(), (int)end.size(), FDB_CONFLICT_RANGE_TYPE_READ) != 0) return NULL;
+  }
+
+  FDBFuture *f = it->second.f;
+  p->keys.erase(it);
+  return f;
+}
+
+static void forgetPrefetched(TransactionWrap *tn, const uint8_t *key, size_t len) {
+  Prefetched *p = tn->prefetched;
+  if (LIKELY(p == NULL)) return;
+  auto it = p->keys.find(string((const char *)key, len));
+  if (it == p->keys.end()) return;
+  fdb_future_destroy(it->second.f);
+  p->keys.erase(it);
+}
+
+// For writes which could touch any key.
+static void forgetAllPrefetched(TransactionWrap *tn) {
+  Prefetched *p = tn->prefetched;
+  if (LIKELY(p == NULL)) return;
+  for (auto &entry : p->keys) fdb_future_destroy(entry.second.f);
+  p->keys.clear();
+}
+
+// Rough size of a fresh native transaction, and the bookkeeping overhead of
+// each mutation on top of its key and value.
+#define TRANSACTION_BASE_BYTES 8192
+#define MUTATION_OVERHEAD_BYTES 48
+#define EXTERNAL_REPORT_BYTES (64 * 1024)
+
+static void trackMemory(napi_env env, TransactionWrap *tn, size_t bytes) {
+  tn->pending_bytes += (int64_t)bytes;
+  if (UNLIKELY(tn->pending_bytes >= EXTERNAL_REPORT_BYTES)) {
+    int64_t total;
+    napi_adjust_external_memory(env, tn->pending_bytes, &total);
+    tn->reported_bytes += tn->pending_bytes;
+    tn->pending_bytes = 0;
+  }
+}
+
+// Tell V8 all but keep bytes of the transaction's memory has been freed.
+static void releaseMemory(napi_env env, TransactionWrap *tn, int64_t keep) {
+  int64_t total;
+  if (tn->reported_bytes != keep) napi_adjust_external_memory(env, keep - tn->reported_bytes, &total);
+  tn->reported_bytes = keep;
+  tn->pending_bytes = 0;
+}
+
+static void finalize(napi_env env, void* data, void* finalize_hint) {
+  TransactionWrap *tn = (TransactionWrap *)data;
+  clearPrefetched(tn);
+  if (tn->tr != NULL) fdb_transaction_destroy(tn->tr);
+  releaseMemory(env, tn, 0);
+  free(tn);
 }
 
 MaybeValue newTransaction(napi_env env, FDBTransaction *transaction) {
   napi_value ctor;
-  TRY(napi_get_reference_value(env, cons_ref, &ctor));
+  TRY(napi_get_reference_value(env, getInstanceData(env)->transaction_cons, &ctor));
+
+  TransactionWrap *tn = (TransactionWrap *)malloc(sizeof(TransactionWrap));
+  if (UNLIKELY(tn == NULL)) {
+    fdb_transaction_destroy(transaction);
+    return wrap_err(throw_if_not_ok(env, napi_generic_failure));
+  }
+  tn->tr = transaction;
+  tn->reported_bytes = tn->pending_bytes = 0;
+  tn->prefetched = NULL;
+  tn->resets = 0;
 
   napi_value obj;
-  TRY(napi_new_instance(env, ctor, 0, NULL, &obj));
-  TRY(napi_wrap(env, obj, (void *)transaction, finalize, NULL, NULL));
+  napi_status status = napi_new_instance(env, ctor, 0, NULL, &obj);
+  if (status == napi_ok) status = napi_wrap(env, obj, (void *)tn, finalize, NULL, NULL);
+  if (UNLIKELY(status != napi_ok)) {
+    fdb_transaction_destroy(transaction);
+    free(tn);
+    return wrap_err(throw_if_not_ok(env, status));
+  }
+
+  int64_t total;
+  napi_adjust_external_memory(env, TRANSACTION_BASE_BYTES, &total);
+  tn->reported_bytes = TRANSACTION_BASE_BYTES;
   return wrap_ok(obj);
 }
 
+// Get the native transaction for a method call. Throws if the transaction
+// has been disposed.
+static FDBTransaction *getTr(napi_env env, napi_callback_info info, TransactionWrap **wrapOut = NULL) {
+  TransactionWrap *tn = (TransactionWrap *)getWrapped(env, info);
+  if (UNLIKELY(tn == NULL)) return NULL;
+  if (UNLIKELY(tn->tr == NULL)) {
+    throw_if_not_ok(env, napi_throw_error(env, NULL, "Transaction has been disposed"));
+    return NULL;
+  }
+  if (wrapOut) *wrapOut = tn;
+  return tn->tr;
+}
+
+// Scratch space for converting string arguments into bytes. Each native call
+// which takes key or value arguments puts one of these on its stack, and the
+// bytes for all of its string arguments are bump allocated out of it. The
+// memory is released when the arena goes out of scope at the end of the call
+// (including on error paths). Strings which don't fit in the inline buffer
+// spill into heap allocated chunks chained off the arena.
+class ScratchArena {
+public:
+  ScratchArena(): used(0), overflow(NULL) {}
+  ~ScratchArena() {
+    while (overflow != NULL) {
+      Chunk *next = overflow->next;
+      free(overflow);
+      overflow = next;
+    }
+  }
+
+  // Returns NULL if we're out of memory.
+  uint8_t *alloc(size_t size) {
+    if (LIKELY(size <= sizeof(buf) - used)) {
+      uint8_t *result = buf + used;
+      used += size;
+      return result;
+    }
+
+    if (overflow != NULL && size <= overflow->size - overflow->used) {
+      uint8_t *result = overflow->data + overflow->used;
+      overflow->used += size;
+      return result;
+    }
+
+    size_t chunkSize = size > MIN_CHUNK_SIZE ? size : MIN_CHUNK_SIZE;
+    Chunk *chunk = (Chunk *)malloc(sizeof(Chunk) + chunkSize);
+    if (chunk == NULL) return NULL;
+    chunk->next = overflow;
+    chunk->size = chunkSize;
+    chunk->used = size;
+    overflow = chunk;
+    return chunk->data;
+  }
+
+  // Get the free space left in the inline buffer. Callers can write directly
+  // into it, then claim the bytes they used with commit().
+  uint8_t *spare(size_t *avail) {
+    *avail = sizeof(buf) - used;
+    return buf + used;
+  }
+
+  void commit(size_t size) {
+    assert(size <= sizeof(buf) - used);
+    used += size;
+  }
+
+private:
+  static const size_t MIN_CHUNK_SIZE = 16384;
+  struct Chunk {
+    Chunk *next;
+    size_t size;
+    size_t used;
+    uint8_t data[1]; // Actually size bytes long.
+  };
+
+  uint8_t buf[8192];
+  size_t used;
+  Chunk *overflow;
+
+  ScratchArena(const ScratchArena&);
+  ScratchArena& operator=(const ScratchArena&);
+};
+
 // This is a helper struct to move strings out of passed buffers into a format
-// accessible to foundationdb. Objects of this class shouldn't be created
-// directly - they should only be created and destroyed via toStringParams and
-// destroyStringParams.
+// accessible to foundationdb. It points either into the passed JS buffer or
+// into a ScratchArena, so it doesn't own any memory.
 typedef struct StringParams {
-  bool owned; // Marks if we're holding memory that needs to be freed.
   uint8_t *str;
   size_t len;
-
-  // This code is mostly straight C code - I'm using these simply to make memory
-  // leaks cause runtime assertions if the struct is used incorrectly. I feel
-  // weird about mixing styles like this though.
-  StringParams(): owned(false) {}
-  ~StringParams() {
-    // The object must be cleaned up manually using destroyStringParams, for
-    // symmetry with toStringParams.
-    assert(owned == false);
-  }
 } StringParams;
 
-// This is a small buffer to avoid thrashing the allocator when reading keys and values.
-// Its a very 95% solution, but it improves performance in the average case.
-// TODO: Many functions make 2 string params objects; not 1. Add a second buffer here.
-static bool buf_in_use = false;
-static uint8_t sp_buf[1024];
-
 // String arguments can either be buffers or strings. If they're strings we
-// need to copy the bytes locally in order to utf8 convert the content.
-static napi_status toStringParams(napi_env env, napi_value value, StringParams *result) {
+// need to copy the bytes into the scratch arena in order to utf8 convert the
+// content.
+static napi_status toStringParams(napi_env env, napi_value value, ScratchArena *scratch, StringParams *result) {
   napi_valuetype type;
   NAPI_OK_OR_RETURN_STATUS(env, napi_typeof(env, value, &type));
   if (type == napi_string) {
-    // First get the length.
+    // Optimistically convert straight into the arena's spare space, so most
+    // strings are only transcoded once. napi silently truncates (at a
+    // character boundary) if the string doesn't fit. A utf8 character is at
+    // most 4 bytes, so if there's more than that left over we know we have
+    // the whole string.
+    size_t avail;
+    uint8_t *dest = scratch->spare(&avail);
+    if (LIKELY(avail > 0)) {
+      NAPI_OK_OR_RETURN_STATUS(env, napi_get_value_string_utf8(env, value, (char *)dest, avail, &result->len));
+      if (LIKELY(result->len + 4 < avail)) {
+        result->str = dest;
+        scratch->commit(result->len + 1);
+        return napi_ok;
+      }
+    }
+
+    // It didn't fit. Get the length and convert it again into new space.
     NAPI_OK_OR_RETURN_STATUS(env, napi_get_value_string_utf8(env, value, NULL, 0, &result->len));
 
-    if (!buf_in_use && result->len <= sizeof(sp_buf)) {
-      result->owned = false;
-      result->str = sp_buf;
-      NAPI_OK_OR_RETURN_STATUS(env, napi_get_value_string_utf8(env, value, (char *)sp_buf, sizeof(sp_buf), NULL));
-      buf_in_use = true; // After fetch function, so the buffer isn't held if an error happens.
-    } else {
-      result->owned = true;
-      result->str = (uint8_t *)malloc(result->len + 1);
-      NAPI_OK_OR_RETURN_STATUS(env, napi_get_value_string_utf8(env, value, (char *)result->str, result->len + 1, NULL));
-    }
+    // +1 because napi always writes a null terminator.
+    result->str = scratch->alloc(result->len + 1);
+    if (UNLIKELY(result->str == NULL)) return napi_generic_failure;
+    NAPI_OK_OR_RETURN_STATUS(env, napi_get_value_string_utf8(env, value, (char *)result->str, result->len + 1, NULL));
   } else {
-    result->owned = false;
-
     bool is_buffer;
     NAPI_OK_OR_RETURN_STATUS(env, is_bufferish(env, value, &is_buffer));
 
@@ -120,14 +332,6 @@ static napi_status toStringParams(napi_env env, napi_value value, StringParams *
   return napi_ok;
 }
 
-static void destroyStringParams(StringParams *params) {
-  if (params->owned) {
-    free(params->str);
-    params->owned = false; // Mark stringparams object as safe to delete.
-  } else if (params->str == sp_buf) buf_in_use = false;
-  params->str = NULL;
-}
-
 
 // dataOut must be a ptr to array of 8 items.
 static void int64ToBEBytes(uint8_t* dataOut, uint64_t num) {
@@ -156,33 +360,59 @@ static MaybeValue wrap_undefined(napi_env env) {
   return result;
 }
 
-static MaybeValue ignoreResult(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
-  *errOut = fdb_future_get_error(future);
+// Values at least this many bytes long are returned from get() as external
+// buffers which point directly into the future's memory, instead of being
+// copied into a new buffer. 0 (the default) disables this. The threshold is
+// per env.
+void set_zero_copy_threshold(napi_env env, size_t bytes) {
+  getInstanceData(env)->zero_copy_threshold = bytes;
+}
+
+static void finalizeExternalValue(napi_env env, void* data, void* future) {
+  // The future still owns the value, so we can just look the length back up.
+  const uint8_t *value;
+  int len;
+  int valuePresent;
+  if (fdb_future_get_value((FDBFuture *)future, &valuePresent, &value, &len) == 0) {
+    napi_adjust_external_memory(env, -(int64_t)len, NULL);
+  }
+  fdb_future_destroy((FDBFuture *)future);
+}
+
+static MaybeValue ignoreResult(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
+  *errOut = fdb_future_get_error(*future);
   return wrap_undefined(env);
 }
 
-static MaybeValue getValue(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
+static MaybeValue getValue(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
   const uint8_t *value;
   int len;
   int valuePresent;
 
-  *errOut = fdb_future_get_value(future, &valuePresent, &value, &len);
+  *errOut = fdb_future_get_value(*future, &valuePresent, &value, &len);
   if (UNLIKELY(*errOut)) return wrap_null();
   else if (!valuePresent) return wrap_undefined(env);
 
-  // TODO
-  // Its a bit yuck that we're copying so much memory here. It would be possible
-  // to avoid this copy and add a reference from the returned buffer to the FDB
-  // promise object for GC.
   napi_value result;
+  size_t zero_copy_threshold = getInstanceData(env)->zero_copy_threshold;
+  if (zero_copy_threshold != 0 && (size_t)len >= zero_copy_threshold) {
+    // Hand the future's memory straight to javascript. The future is destroyed
+    // when the buffer is garbage collected.
+    if (napi_create_external_buffer(env, (size_t)len, (void *)value, finalizeExternalValue, *future, &result) == napi_ok) {
+      *future = NULL;
+      napi_adjust_external_memory(env, len, NULL);
+      return wrap_ok(result);
+    }
+    // Some runtimes (eg electron) don't allow external buffers. Just copy.
+  }
   TRY(napi_create_buffer_copy(env, (size_t)len, (void *)value, NULL, &result));
   return wrap_ok(result);
 }
 
-static MaybeValue getKey(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
+static MaybeValue getKey(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
   const uint8_t *key;
   int len;
-  *errOut = fdb_future_get_key(future, &key, &len);
+  *errOut = fdb_future_get_key(*future, &key, &len);
   if (UNLIKELY(*errOut)) return wrap_null();
 
   // get_key can't / doesn't differentiate between returning the empty key ("")
@@ -197,12 +427,12 @@ static MaybeValue getKey(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
   return wrap_ok(result);
 }
 
-static MaybeValue getKeyValueList(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
+static MaybeValue getKeyValueList(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
   const FDBKeyValue *kv;
   int len;
   fdb_bool_t more;
 
-  *errOut = fdb_future_get_keyvalue_array(future, &kv, &len, &more);
+  *errOut = fdb_future_get_keyvalue_array(*future, &kv, &len, &more);
   if (UNLIKELY(*errOut)) return wrap_null();
 
   /*
@@ -237,11 +467,61 @@ static MaybeValue getKeyValueList(napi_env env, FDBFuture* future, fdb_error_t*
   return wrap_ok(returnObj);
 }
 
-static MaybeValue getStringArray(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
+// This is the same as getKeyValueList, but it packs all the keys and values
+// into one buffer so we don't need to create JS objects for every row:
+// { data: Buffer, offsets: Uint32Array, more }
+// Key i is data[offsets[2i] .. offsets[2i+1]] and its value is
+// data[offsets[2i+1] .. offsets[2i+2]].
+static MaybeValue getKeyValueListPacked(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
+  const FDBKeyValue *kv;
+  int len;
+  fdb_bool_t more;
+
+  *errOut = fdb_future_get_keyvalue_array(*future, &kv, &len, &more);
+  if (UNLIKELY(*errOut)) return wrap_null();
+
+  size_t totalBytes = 0;
+  for (int i = 0; i < len; i++) totalBytes += kv[i].key_length + kv[i].value_length;
+
+  napi_value data;
+  uint8_t *dataPtr;
+  TRY(napi_create_buffer(env, totalBytes, (void **)&dataPtr, &data));
+
+  size_t numOffsets = (size_t)len * 2 + 1;
+  napi_value offsetsBuf;
+  uint32_t *offsets;
+  TRY(napi_create_arraybuffer(env, numOffsets * sizeof(uint32_t), (void **)&offsets, &offsetsBuf));
+  napi_value jsOffsets;
+  TRY(napi_create_typedarray(env, napi_uint32_array, numOffsets, offsetsBuf, 0, &jsOffsets));
+
+  uint32_t pos = 0;
+  for (int i = 0; i < len; i++) {
+    offsets[i*2] = pos;
+    memcpy(dataPtr + pos, kv[i].key, kv[i].key_length);
+    pos += kv[i].key_length;
+
+    offsets[i*2 + 1] = pos;
+    memcpy(dataPtr + pos, kv[i].value, kv[i].value_length);
+    pos += kv[i].value_length;
+  }
+  offsets[len*2] = pos;
+
+  napi_value returnObj;
+  TRY(napi_create_object(env, &returnObj));
+  TRY(napi_set_named_property(env, returnObj, "data", data));
+  TRY(napi_set_named_property(env, returnObj, "offsets", jsOffsets));
+  napi_value jsMore;
+  TRY(napi_get_boolean(env, !!more, &jsMore));
+  TRY(napi_set_named_property(env, returnObj, "more", jsMore));
+
+  return wrap_ok(returnObj);
+}
+
+static MaybeValue getStringArray(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
   const char **strings;
   int stringCount;
 
-  *errOut = fdb_future_get_string_array(future, &strings, &stringCount);
+  *errOut = fdb_future_get_string_array(*future, &strings, &stringCount);
   if (UNLIKELY(*errOut)) return wrap_null();
 
   napi_value jsArray;
@@ -266,18 +546,18 @@ static MaybeValue versionToJSBuffer(napi_env env, int64_t version) {
   return wrap_ok(result);
 }
 
-static MaybeValue getInt64ToBuffer(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
+static MaybeValue getInt64ToBuffer(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
   int64_t version;
-  *errOut = fdb_future_get_int64(future, &version);
+  *errOut = fdb_future_get_int64(*future, &version);
 
   // See discussion about buffers vs storing the version as a JS number:
   // https://forums.foundationdb.org/t/version-length-is-53-bits-enough/260/6
   return UNLIKELY(*errOut) ? wrap_null() : versionToJSBuffer(env, version);
 }
 
-static MaybeValue getInt64ToNumber(napi_env env, FDBFuture* future, fdb_error_t* errOut) {
+static MaybeValue getInt64ToNumber(napi_env env, FDBFuture** future, fdb_error_t* errOut) {
   int64_t val;
-  *errOut = fdb_future_get_int64(future, &val);
+  *errOut = fdb_future_get_int64(*future, &val);
   if (UNLIKELY(*errOut)) return wrap_null();
 
   napi_value result;
@@ -289,7 +569,7 @@ static MaybeValue getInt64ToNumber(napi_env env, FDBFuture* future, fdb_error_t*
 
 
 static napi_value setOption(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   set_option_wrapped(env, tr, OptTransaction, info);
@@ -298,7 +578,7 @@ static napi_value setOption(napi_env env, napi_callback_info info) {
 
 // commit()
 static napi_value commit(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   FDBFuture *f = fdb_transaction_commit(tr);
@@ -307,15 +587,45 @@ static napi_value commit(napi_env env, napi_callback_info info) {
   return futureToJS(env, f, args[0], ignoreResult).value;
 }
 
+// commitBlocking(). Worker threads only.
+static napi_value commitBlocking(napi_env env, napi_callback_info info) {
+  if (!blockingAllowed(env)) return NULL;
+  FDBTransaction *tr = getTr(env, info);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  return futureToJSBlocking(env, fdb_transaction_commit(tr), ignoreResult).value;
+}
+
 // Reset the transaction so it can be reused.
 static napi_value reset(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
-  if (LIKELY(tr != NULL)) fdb_transaction_reset(tr);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (LIKELY(tr != NULL)) {
+    clearPrefetched(tn);
+    fdb_transaction_reset(tr);
+    tn->resets++;
+    releaseMemory(env, tn, TRANSACTION_BASE_BYTES);
+  }
+  return NULL;
+}
+
+// dispose(). Destroy the native transaction now instead of waiting for the
+// garbage collector to get around to it. Outstanding futures are cancelled
+// and any further calls on the transaction throw. Calling this more than
+// once is harmless.
+static napi_value dispose(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn = (TransactionWrap *)getWrapped(env, info);
+  if (UNLIKELY(tn == NULL) || tn->tr == NULL) return NULL;
+
+  clearPrefetched(tn);
+  fdb_transaction_destroy(tn->tr);
+  tn->tr = NULL;
+  releaseMemory(env, tn, 0);
   return NULL;
 }
 
 static napi_value cancel(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (LIKELY(tr != NULL)) fdb_transaction_cancel(tr);
   return NULL;
 }
@@ -323,56 +633,283 @@ static napi_value cancel(napi_env env, napi_callback_info info) {
 // See fdb_transaction_on_error documentation to see how to handle this.
 // This is all wrapped by JS.
 static napi_value onError(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   GET_ARGS(env, info, args, 2);
 
   fdb_error_t errorCode;
   TRY_V(napi_get_value_int32(env, args[0], &errorCode));
+  // On success this resets the transaction, which would fail any reads
+  // prefetched before it.
+  clearPrefetched(tn);
   FDBFuture *f = fdb_transaction_on_error(tr, errorCode);
   return futureToJS(env, f, args[1], ignoreResult).value;
 }
 
+// onErrorBlocking(code). Worker threads only. Returns once the transaction
+// is ready to retry, or throws if it shouldn't be.
+static napi_value onErrorBlocking(napi_env env, napi_callback_info info) {
+  if (!blockingAllowed(env)) return NULL;
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 1);
+
+  fdb_error_t errorCode;
+  TRY_V(napi_get_value_int32(env, args[0], &errorCode));
+  clearPrefetched(tn);
+  return futureToJSBlocking(env, fdb_transaction_on_error(tr, errorCode), ignoreResult).value;
+}
+
 static napi_value getApproximateSize(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   FDBFuture *f = fdb_transaction_get_approximate_size(tr);
   return futureToJS(env, f, NULL, getInt64ToNumber).value;
 }
 
+// getEstimatedRangeSizeBytes(start, end) -> Promise<number>. This comes from
+// the storage servers' byte samples, so it's only rough for small ranges.
+static napi_value getEstimatedRangeSizeBytes(napi_env env, napi_callback_info info) {
+  FDBTransaction *tr = getTr(env, info);
+  if (UNLIKELY(tr == NULL)) return NULL;
+  GET_ARGS(env, info, args, 2);
+
+  ScratchArena scratch;
+  StringParams start, end;
+  TRY_V(toStringParams(env, args[0], &scratch, &start));
+  TRY_V(toStringParams(env, args[1], &scratch, &end));
+
+  FDBFuture *f = fdb_transaction_get_estimated_range_size_bytes(tr, start.str, (int)start.len, end.str, (int)end.len);
+  return futureToJS(env, f, NULL, getInt64ToNumber).value;
+}
+
 
 // Get(key, isSnapshot, [cb])
 static napi_value get(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   GET_ARGS(env, info, args, 3);
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[0], &key));
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
 
   bool snapshot;
   TRY_V(napi_get_value_bool(env, args[1], &snapshot));
 
-  FDBFuture *f = fdb_transaction_get(tr, key.str, key.len, snapshot);
-  destroyStringParams(&key);
+  FDBFuture *f = claimPrefetched(tn, key.str, key.len, snapshot);
+  if (f == NULL) f = fdb_transaction_get(tr, key.str, key.len, snapshot);
   return futureToJS(env, f, args[2], getValue).value;
 }
 
+// getBlocking(key, isSnapshot) -> value. Worker threads only.
+static napi_value getBlocking(napi_env env, napi_callback_info info) {
+  if (!blockingAllowed(env)) return NULL;
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 2);
+
+  ScratchArena scratch;
+  StringParams key;
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
+
+  bool snapshot;
+  TRY_V(napi_get_value_bool(env, args[1], &snapshot));
+
+  FDBFuture *f = claimPrefetched(tn, key.str, key.len, snapshot);
+  if (f == NULL) f = fdb_transaction_get(tr, key.str, key.len, snapshot);
+  return futureToJSBlocking(env, f, getValue).value;
+}
+
+// getMaybeSync(key, isSnapshot) -> value or Promise<value>.
+//
+// Like get, but if the read can be answered straight away (usually from the
+// transaction's read-your-writes cache) the value is returned directly. Throws
+// if the read failed straight away.
+static napi_value getMaybeSync(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 2);
+
+  ScratchArena scratch;
+  StringParams key;
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
+
+  bool snapshot;
+  TRY_V(napi_get_value_bool(env, args[1], &snapshot));
+
+  FDBFuture *f = claimPrefetched(tn, key.str, key.len, snapshot);
+  if (f == NULL) f = fdb_transaction_get(tr, key.str, key.len, snapshot);
+  if (!fdb_future_is_ready(f)) return futureToJS(env, f, NULL, getValue).value;
+  countReadyFastPath(env);
+
+  fdb_error_t errcode = 0;
+  MaybeValue value = getValue(env, &f, &errcode);
+  if (f) fdb_future_destroy(f);
+  if (errcode != 0) throw_fdb_error(env, errcode);
+  // NULL (undefined in JS) if the key is missing, or with the exception
+  // pending if extracting the value failed.
+  return value.value;
+}
+
+// getMany([keys], isSnapshot). Returns a promise.
+//
+// Starts a read for every key at once, and resolves a single promise with an
+// array of the values (undefined for missing keys) once they've all arrived.
+static napi_value getMany(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 2);
+
+  uint32_t count;
+  TRY_V(napi_get_array_length(env, args[0], &count));
+
+  bool snapshot;
+  TRY_V(napi_get_value_bool(env, args[1], &snapshot));
+
+  FDBFuture **futures = (FDBFuture **)malloc((count > 0 ? count : 1) * sizeof(FDBFuture *));
+  if (UNLIKELY(futures == NULL)) {
+    throw_if_not_ok(env, napi_generic_failure);
+    return NULL;
+  }
+
+  napi_status status = napi_ok;
+  uint32_t started = 0;
+  for (; started < count; started++) {
+    napi_value jsKey;
+    status = napi_get_element(env, args[0], started, &jsKey);
+    if (status != napi_ok) break;
+
+    // The key is copied by fdb_transaction_get, so the arena is only needed
+    // for this iteration.
+    ScratchArena scratch;
+    StringParams key;
+    status = toStringParams(env, jsKey, &scratch, &key);
+    if (status != napi_ok) break;
+
+    FDBFuture *f = claimPrefetched(tn, key.str, key.len, snapshot);
+    futures[started] = f != NULL ? f : fdb_transaction_get(tr, key.str, key.len, snapshot);
+  }
+
+  napi_value result = NULL;
+  if (status == napi_ok) {
+    result = futuresToJSArray(env, futures, count, getValue).value;
+  } else {
+    for (uint32_t i = 0; i < started; i++) fdb_future_destroy(futures[i]);
+    throw_if_not_ok(env, status);
+  }
+  free(futures);
+  return result;
+}
+
+// prefetch([keys], isSnapshot). Syncronous.
+//
+// Starts reading keys, without waiting for the results. A later get() or
+// getMany() of one of the keys picks up the read where it is.
+static napi_value prefetch(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 2);
+
+  uint32_t count;
+  TRY_V(napi_get_array_length(env, args[0], &count));
+
+  bool snapshot;
+  TRY_V(napi_get_value_bool(env, args[1], &snapshot));
+
+  if (tn->prefetched == NULL) tn->prefetched = new Prefetched;
+  auto &keys = tn->prefetched->keys;
+
+  for (uint32_t i = 0; i < count; i++) {
+    napi_value jsKey;
+    TRY_V(napi_get_element(env, args[0], i, &jsKey));
+    ScratchArena scratch;
+    StringParams key;
+    TRY_V(toStringParams(env, jsKey, &scratch, &key));
+
+    // If the key is already being fetched, keep the existing read unless
+    // it's a snapshot read and this isn't.
+    auto result = keys.emplace(string((const char *)key.str, key.len), Prefetched::Read {NULL, snapshot});
+    Prefetched::Read &read = result.first->second;
+    if (!result.second) {
+      if (snapshot || !read.snapshot) continue;
+      fdb_future_destroy(read.f);
+      read.snapshot = false;
+    }
+    read.f = fdb_transaction_get(tr, key.str, key.len, snapshot);
+  }
+  return NULL;
+}
+
+// prefetchRange(
+//   start, beginOrEqual, beginOffset,
+//   end, endOrEqual, endOffset,
+//   limit or 0, target_bytes or 0,
+//   streamingMode, snapshot, reverse
+// ). Syncronous.
+//
+// Starts reading the first batch of a range into the transaction's read
+// cache, so a later getRange over it doesn't wait for the network.
+static napi_value prefetchRange(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 11);
+
+  ScratchArena scratch;
+  StringParams start, end;
+  bool startOrEqual, endOrEqual, snapshot, reverse;
+  int32_t startOffset, endOffset, limit, target_bytes, modeInt;
+  TRY_V(toStringParams(env, args[0], &scratch, &start));
+  TRY_V(napi_get_value_bool(env, args[1], &startOrEqual));
+  TRY_V(napi_get_value_int32(env, args[2], &startOffset));
+  TRY_V(toStringParams(env, args[3], &scratch, &end));
+  TRY_V(napi_get_value_bool(env, args[4], &endOrEqual));
+  TRY_V(napi_get_value_int32(env, args[5], &endOffset));
+  TRY_V(napi_get_value_int32(env, args[6], &limit));
+  TRY_V(napi_get_value_int32(env, args[7], &target_bytes));
+  TRY_V(napi_get_value_int32(env, args[8], &modeInt));
+  TRY_V(napi_get_value_bool(env, args[9], &snapshot));
+  TRY_V(napi_get_value_bool(env, args[10], &reverse));
+
+  if (tn->prefetched == NULL) tn->prefetched = new Prefetched;
+  tn->prefetched->ranges.push_back(fdb_transaction_get_range(tr,
+    start.str, (int)start.len, startOrEqual, startOffset,
+    end.str, (int)end.len, endOrEqual, endOffset,
+    limit, target_bytes, (FDBStreamingMode)modeInt, 1,
+    snapshot, reverse));
+  return NULL;
+}
+
 /*
  * This function takes a KeySelector and returns a future.
  */
 // GetKey(key, selOrEq, offset, isSnapshot, [cb])
 static napi_value getKey(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   GET_ARGS(env, info, args, 5);
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[0], &key));
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
 
   bool selectorOrEqual;
   TRY_V(napi_get_value_bool(env, args[1], &selectorOrEqual));
@@ -384,65 +921,168 @@ static napi_value getKey(napi_env env, napi_callback_info info) {
   TRY_V(napi_get_value_bool(env, args[3], &snapshot));
 
   FDBFuture *f = fdb_transaction_get_key(tr, key.str, key.len, (fdb_bool_t)selectorOrEqual, selectorOffset, snapshot);
-  destroyStringParams(&key);
   return futureToJS(env, f, args[4], getKey).value;
 }
 
 // set(key, val). Syncronous.
 static napi_value set(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 2);
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[0], &key));
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
   StringParams val;
-  TRY_V(toStringParams(env, args[1], &val));
+  TRY_V(toStringParams(env, args[1], &scratch, &val));
   fdb_transaction_set(tr, key.str, key.len, val.str, val.len);
+  forgetPrefetched(tn, key.str, key.len);
+  trackMemory(env, tn, key.len + val.len + MUTATION_OVERHEAD_BYTES);
 
-  destroyStringParams(&key);
-  destroyStringParams(&val);
   return NULL;
 }
 
 // Delete value stored for key.
 // clear("somekey")
 static napi_value clear(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 1);
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[0], &key));
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
 
   fdb_transaction_clear(tr, key.str, key.len);
+  forgetPrefetched(tn, key.str, key.len);
+  trackMemory(env, tn, key.len + MUTATION_OVERHEAD_BYTES);
 
-  destroyStringParams(&key);
   return NULL;
 }
 
 // atomicOp(key, operand key, mutationtype)
 static napi_value atomicOp(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 3);
 
   int32_t operationType; // actually a FDBMutationType, but we'll store an int worth of memory.
   TRY_V(napi_get_value_int32(env, args[0], &operationType));
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[1], &key));
+  TRY_V(toStringParams(env, args[1], &scratch, &key));
   StringParams operand;
-  TRY_V(toStringParams(env, args[2], &operand));
+  TRY_V(toStringParams(env, args[2], &scratch, &operand));
 
   fdb_transaction_atomic_op(tr, key.str, key.len, operand.str, operand.len, (FDBMutationType)operationType);
+  // Versionstamped keys are written somewhere other than the key we were given.
+  if (operationType == FDB_MUTATION_TYPE_SET_VERSIONSTAMPED_KEY) forgetAllPrefetched(tn);
+  else forgetPrefetched(tn, key.str, key.len);
+  trackMemory(env, tn, key.len + operand.len + MUTATION_OVERHEAD_BYTES);
+
+  return NULL;
+}
+
+// Op codes in a packed mutation list. Anything else is the FDBMutationType of
+// an atomic op. (Mutation types 0 and 1 aren't used by the C API.)
+#define MUTATION_OP_SET 0
+#define MUTATION_OP_CLEAR 1
+
+// Read one length prefixed field from a packed mutation list. Returns false
+// if the field runs off the end of the buffer.
+static bool readMutationField(const uint8_t **pos, const uint8_t *end, const uint8_t **fieldOut, uint32_t *lenOut) {
+  if (UNLIKELY(end - *pos < 4)) return false;
+  const uint8_t *p = *pos;
+  uint32_t len = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  p += 4;
+  if (UNLIKELY((size_t)(end - p) < len)) return false;
+  *fieldOut = p;
+  *lenOut = len;
+  *pos = p + len;
+  return true;
+}
+
+// Is op the FDBMutationType of an atomic op the C API accepts?
+static bool isAtomicOp(uint8_t op) {
+  switch (op) {
+    case FDB_MUTATION_TYPE_ADD:
+    case FDB_MUTATION_TYPE_BIT_AND:
+    case FDB_MUTATION_TYPE_BIT_OR:
+    case FDB_MUTATION_TYPE_BIT_XOR:
+    case FDB_MUTATION_TYPE_APPEND_IF_FITS:
+    case FDB_MUTATION_TYPE_MAX:
+    case FDB_MUTATION_TYPE_MIN:
+    case FDB_MUTATION_TYPE_SET_VERSIONSTAMPED_KEY:
+    case FDB_MUTATION_TYPE_SET_VERSIONSTAMPED_VALUE:
+    case FDB_MUTATION_TYPE_BYTE_MIN:
+    case FDB_MUTATION_TYPE_BYTE_MAX:
+    case FDB_MUTATION_TYPE_COMPARE_AND_CLEAR:
+      return true;
+    default: return false;
+  }
+}
+
+// Walk a packed mutation list. If tr is NULL this only checks the list is
+// well formed and every op code is valid.
+static bool forEachMutation(FDBTransaction *tr, const uint8_t *data, size_t len) {
+  const uint8_t *pos = data, *end = data + len;
+  while (pos < end) {
+    uint8_t op = *pos++;
+    const uint8_t *key, *val = NULL;
+    uint32_t keyLen, valLen = 0;
+    if (!readMutationField(&pos, end, &key, &keyLen)) return false;
+    if (op != MUTATION_OP_CLEAR && !readMutationField(&pos, end, &val, &valLen)) return false;
+
+    if (tr == NULL) {
+      if (op != MUTATION_OP_SET && op != MUTATION_OP_CLEAR && !isAtomicOp(op)) return false;
+      continue;
+    }
+    switch (op) {
+      case MUTATION_OP_SET: fdb_transaction_set(tr, key, keyLen, val, valLen); break;
+      case MUTATION_OP_CLEAR: fdb_transaction_clear(tr, key, keyLen); break;
+      default: fdb_transaction_atomic_op(tr, key, keyLen, val, valLen, (FDBMutationType)op); break;
+    }
+  }
+  return true;
+}
+
+// applyMutations(buffer). Syncronous.
+//
+// Applies a list of mutations packed into a single buffer. This is much
+// cheaper than calling set / clear / atomicOp once per mutation. Each
+// mutation is an op code byte, followed by the key and (except for clears)
+// the value or operand. Keys and values are each prefixed with their length
+// as a 32 bit little endian integer. See lib/mutationBatch.ts.
+static napi_value applyMutations(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+  GET_ARGS(env, info, args, 1);
+
+  uint8_t *data;
+  size_t len;
+  TRY_V(get_buffer_info(env, args[0], (void **)&data, &len));
+
+  // Check the whole list first so a malformed buffer doesn't leave the
+  // transaction with only some of its mutations applied.
+  if (UNLIKELY(!forEachMutation(NULL, data, len))) {
+    throw_if_not_ok(env, napi_throw_error(env, NULL, "Invalid packed mutation list"));
+    return NULL;
+  }
+  forEachMutation(tr, data, len);
+  forgetAllPrefetched(tn);
+  // The list's framing is about the size of the per mutation overhead.
+  trackMemory(env, tn, len);
 
-  destroyStringParams(&key);
-  destroyStringParams(&operand);
   return NULL;
 }
 
-// getRange(
+// Not exposed to JS. Called by getRange / getRangePacked with the arguments:
+// (
 //   start, beginOrEqual, beginOffset,
 //   end, endOrEqual, endOffset,
 //   limit or 0, target_bytes or 0,
@@ -450,14 +1090,16 @@ static napi_value atomicOp(napi_env env, napi_callback_info info) {
 //   snapshot, reverse,
 //   [cb]
 // )
-static napi_value getRange(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+static napi_value getRangeWith(napi_env env, napi_callback_info info, ExtractValueFn *extractFn, bool blocking) {
+  if (blocking && !blockingAllowed(env)) return NULL;
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   GET_ARGS(env, info, args, 13);
 
+  ScratchArena scratch;
   StringParams start;
-  TRY_V(toStringParams(env, args[0], &start));
+  TRY_V(toStringParams(env, args[0], &scratch, &start));
 
   bool startOrEqual;
   TRY_V(napi_get_value_bool(env, args[1], &startOrEqual));
@@ -465,7 +1107,7 @@ static napi_value getRange(napi_env env, napi_callback_info info) {
   TRY_V(napi_get_value_int32(env, args[2], &startOffset));
 
   StringParams end;
-  TRY_V(toStringParams(env, args[3], &end));
+  TRY_V(toStringParams(env, args[3], &scratch, &end));
   bool endOrEqual;
   TRY_V(napi_get_value_bool(env, args[4], &endOrEqual));
   int32_t endOffset;
@@ -494,26 +1136,573 @@ static napi_value getRange(napi_env env, napi_callback_info info) {
     mode, iteration,
     snapshot, reverse);
 
-  destroyStringParams(&start);
-  destroyStringParams(&end);
+  return blocking
+    ? futureToJSBlocking(env, f, extractFn).value
+    : futureToJS(env, f, args[12], extractFn).value;
+}
+
+// getRange(...) -> {results: [[key, value], ...], more}
+static napi_value getRange(napi_env env, napi_callback_info info) {
+  return getRangeWith(env, info, getKeyValueList, false);
+}
+
+// getRangePacked(...) -> {data, offsets, more}
+static napi_value getRangePacked(napi_env env, napi_callback_info info) {
+  return getRangeWith(env, info, getKeyValueListPacked, false);
+}
+
+// getRangeBlocking(...) -> {results, more}. Worker threads only. Takes the
+// same arguments as getRange, without the callback.
+static napi_value getRangeBlocking(napi_env env, napi_callback_info info) {
+  return getRangeWith(env, info, getKeyValueList, true);
+}
+
+// *** Range rings
+
+// A range ring is a SharedArrayBuffer which range results are copied into
+// straight from the FDB network thread, for other threads to read. See
+// lib/rangeRing.ts for the javascript side, which this layout must match.
+//
+// The buffer starts with a header of int32 fields. The rest is a circular
+// buffer of chunks, one per batch. Each chunk is 4 byte aligned:
+//
+//   [size u32] [count u32] [offsets u32 * (2*count + 1)] [keys and values]
+//
+// with the same offsets as getRangePacked. A size of RING_WRAP marks the end of
+// the used space before the buffer wraps around to 0. Only the producer moves
+// the head and only readers move the tail. Head == tail means the ring is
+// empty, so the ring is never allowed to fill completely.
+#define RING_HEADER_BYTES 32
+#define RING_HEAD 0
+#define RING_TAIL 1
+#define RING_WRAP 0xffffffff
+
+struct RingRead {
+  napi_ref jsRing; // Keeps the ring's memory alive.
+  napi_deferred deferred;
+  uint8_t *mem;
+  size_t len;
+
+  // Set by copyToRing.
+  bool copied;
+  uint32_t count;
+};
+
+static std::atomic<int32_t> *ringField(uint8_t *mem, int field) {
+  return reinterpret_cast<std::atomic<int32_t> *>(mem) + field;
+}
+
+// Returns where a chunk of size bytes can go, or -1 if it doesn't fit yet.
+static int64_t ringFit(uint32_t head, uint32_t tail, uint32_t capacity, uint32_t size) {
+  if (head >= tail) {
+    // Landing exactly on the end wraps head to 0, which mustn't hit the tail.
+    if (size + (tail == 0 ? 4 : 0) <= capacity - head) return head;
+    if (size + 4 <= tail) return 0;
+    return -1;
+  }
+  return size + 4 <= tail - head ? head : -1;
+}
+
+// Called on the network thread when a ring read resolves. If the batch
+// doesn't fit, nothing is written and javascript gets an error - the ring
+// code only requests batches once it knows there's room for them.
+static void copyToRing(FDBFuture *f, void *data) {
+  RingRead *r = (RingRead *)data;
+
+  const FDBKeyValue *kv;
+  int len;
+  fdb_bool_t more;
+  if (fdb_future_get_keyvalue_array(f, &kv, &len, &more) != 0) return;
+
+  size_t dataBytes = 0;
+  for (int i = 0; i < len; i++) dataBytes += kv[i].key_length + kv[i].value_length;
+  size_t size = (8 + 4 * ((size_t)len * 2 + 1) + dataBytes + 3) & ~(size_t)3;
+
+  uint8_t *buf = r->mem + RING_HEADER_BYTES;
+  uint32_t capacity = (uint32_t)(r->len - RING_HEADER_BYTES);
+  uint32_t head = (uint32_t)ringField(r->mem, RING_HEAD)->load(std::memory_order_acquire);
+  uint32_t tail = (uint32_t)ringField(r->mem, RING_TAIL)->load(std::memory_order_acquire);
+  if (size > capacity) return;
+  int64_t at = ringFit(head, tail, capacity, (uint32_t)size);
+  if (at < 0) return;
+  if (at != head) *(uint32_t *)(buf + head) = RING_WRAP;
+
+  uint32_t *chunk = (uint32_t *)(buf + at);
+  chunk[0] = (uint32_t)size;
+  chunk[1] = (uint32_t)len;
+  uint32_t *offsets = chunk + 2;
+  uint8_t *out = (uint8_t *)(offsets + len * 2 + 1);
+  uint32_t pos = 0;
+  for (int i = 0; i < len; i++) {
+    offsets[i*2] = pos;
+    memcpy(out + pos, kv[i].key, kv[i].key_length);
+    pos += kv[i].key_length;
+
+    offsets[i*2 + 1] = pos;
+    memcpy(out + pos, kv[i].value, kv[i].value_length);
+    pos += kv[i].value_length;
+  }
+  offsets[len*2] = pos;
+
+  uint32_t next = (uint32_t)(at + size);
+  if (next == capacity) next = 0;
+  // Publishes the chunk to readers.
+  ringField(r->mem, RING_HEAD)->store((int32_t)next, std::memory_order_seq_cst);
+
+  r->copied = true;
+  r->count = (uint32_t)len;
+}
+
+// Called on the main thread once the batch is in the ring (or failed).
+static napi_status onRingRead(napi_env env, FDBFuture *f, void *data) {
+  RingRead *r = (RingRead *)data;
+  napi_deferred deferred = r->deferred;
+
+  const FDBKeyValue *kv;
+  int len;
+  fdb_bool_t more;
+  fdb_error_t errcode = fdb_future_get_keyvalue_array(f, &kv, &len, &more);
+  bool copied = r->copied;
+  uint32_t count = r->count;
+
+  napi_delete_reference(env, r->jsRing);
+  free(r);
+
+  napi_status status = napi_ok;
+  napi_value err = NULL, result = NULL;
+  if (errcode != 0) {
+    status = wrap_fdb_error(env, errcode, &err);
+  } else if (!copied) {
+    napi_value msg;
+    status = napi_create_string_utf8(env, "Range batch does not fit in the ring", NAPI_AUTO_LENGTH, &msg);
+    if (status == napi_ok) status = napi_create_error(env, NULL, msg, &err);
+  } else {
+    // {count, more, lastKey}
+    napi_value val;
+    status = napi_create_object(env, &result);
+    if (status == napi_ok) status = napi_create_uint32(env, count, &val);
+    if (status == napi_ok) status = napi_set_named_property(env, result, "count", val);
+    if (status == napi_ok) status = napi_get_boolean(env, !!more, &val);
+    if (status == napi_ok) status = napi_set_named_property(env, result, "more", val);
+    if (status == napi_ok && len > 0) {
+      status = napi_create_buffer_copy(env, kv[len-1].key_length, kv[len-1].key, NULL, &val);
+      if (status == napi_ok) status = napi_set_named_property(env, result, "lastKey", val);
+    }
+  }
+  fdb_future_destroy(f);
+
+  if (status != napi_ok) {
+    // Don't leave the promise hanging.
+    napi_get_and_clear_last_exception(env, &err);
+    if (err == NULL) napi_get_undefined(env, &err);
+    napi_reject_deferred(env, deferred, err);
+    return status;
+  }
+  return result
+    ? napi_resolve_deferred(env, deferred, result)
+    : napi_reject_deferred(env, deferred, err);
+}
+
+// getRangeIntoRing(
+//   ring (Uint8Array over a SharedArrayBuffer),
+//   start, beginOrEqual, beginOffset,
+//   end, endOrEqual, endOffset,
+//   limit or 0, target_bytes or 0,
+//   streamingMode, iteration,
+//   snapshot, reverse
+// ) -> Promise<{count, more, lastKey}>
+//
+// Reads one batch of the range. The network thread copies it into the ring,
+// then the promise resolves on the main thread. Nothing else about the ring
+// is touched here - see lib/rangeRing.ts.
+static napi_value getRangeIntoRing(napi_env env, napi_callback_info info) {
+  FDBTransaction *tr = getTr(env, info);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  GET_ARGS(env, info, args, 13);
+
+  bool isTypedArray;
+  TRY_V(napi_is_typedarray(env, args[0], &isTypedArray));
+  napi_typedarray_type arrayType = napi_int8_array;
+  size_t ringLen = 0;
+  void *ringMem = NULL;
+  if (isTypedArray) {
+    TRY_V(napi_get_typedarray_info(env, args[0], &arrayType, &ringLen, &ringMem, NULL, NULL));
+  }
+  if (!isTypedArray || arrayType != napi_uint8_array
+      || ((uintptr_t)ringMem & 3) != 0 || ringLen <= RING_HEADER_BYTES || (ringLen & 3) != 0) {
+    throw_if_not_ok(env, napi_throw_type_error(env, NULL, "Invalid range ring"));
+    return NULL;
+  }
+
+  ScratchArena scratch;
+  StringParams start, end;
+  bool startOrEqual, endOrEqual, snapshot, reverse;
+  int32_t startOffset, endOffset, limit, target_bytes, modeInt, iteration;
+  TRY_V(toStringParams(env, args[1], &scratch, &start));
+  TRY_V(napi_get_value_bool(env, args[2], &startOrEqual));
+  TRY_V(napi_get_value_int32(env, args[3], &startOffset));
+  TRY_V(toStringParams(env, args[4], &scratch, &end));
+  TRY_V(napi_get_value_bool(env, args[5], &endOrEqual));
+  TRY_V(napi_get_value_int32(env, args[6], &endOffset));
+  TRY_V(napi_get_value_int32(env, args[7], &limit));
+  TRY_V(napi_get_value_int32(env, args[8], &target_bytes));
+  TRY_V(napi_get_value_int32(env, args[9], &modeInt));
+  TRY_V(napi_get_value_int32(env, args[10], &iteration));
+  TRY_V(napi_get_value_bool(env, args[11], &snapshot));
+  TRY_V(napi_get_value_bool(env, args[12], &reverse));
+
+  RingRead *r = (RingRead *)calloc(1, sizeof(RingRead));
+  if (UNLIKELY(r == NULL)) {
+    throw_if_not_ok(env, napi_generic_failure);
+    return NULL;
+  }
+  r->mem = (uint8_t *)ringMem;
+  r->len = ringLen;
+
+  napi_value promise;
+  napi_status status = napi_create_reference(env, args[0], 1, &r->jsRing);
+  if (status == napi_ok) status = napi_create_promise(env, &r->deferred, &promise);
+  if (status != napi_ok) {
+    if (r->jsRing) napi_delete_reference(env, r->jsRing);
+    free(r);
+    throw_if_not_ok(env, status);
+    return NULL;
+  }
+
+  FDBFuture *f = fdb_transaction_get_range(tr,
+    start.str, start.len, (fdb_bool_t)startOrEqual, startOffset,
+    end.str, end.len, (fdb_bool_t)endOrEqual, endOffset,
+    limit, target_bytes,
+    (FDBStreamingMode)modeInt, iteration,
+    snapshot, reverse);
+
+  // From here on onRingRead cleans up.
+  TRY_V(futureWhenReady(env, f, onRingRead, r, copyToRing));
+  return promise;
+}
+
+// *** RangeIterator
+
+// A range read which fetches ahead of the consumer. As soon as a batch
+// arrives (and its last key is known) the request for the next batch is sent,
+// without waiting for javascript to ask for it. Up to depth batches are kept
+// buffered or in flight. Javascript pulls completed batches with next().
+//
+// Batches are requested from the main thread when the previous one resolves,
+// so there's only ever one request in flight. That's a limitation of range
+// reads, not this code - we can't know where batch i+1 starts until batch i
+// has arrived.
+
+#define RANGE_ITERATOR_MAX_DEPTH 64
+
+struct RangeIterator {
+  TransactionWrap *tn; // tn->tr is NULL if the transaction was disposed.
+  uint32_t resets; // tn->resets when the iterator was created.
+  napi_env env;
+  napi_ref jsTn; // Keeps the transaction alive.
+  napi_ref self; // Strong only while a request is in flight.
+
+  // The selectors for the rest of the range. Keys are owned by the iterator.
+  uint8_t *startKey, *endKey;
+  int startLen, endLen;
+  bool startOrEqual, endOrEqual;
+  int32_t startOffset, endOffset;
+
+  int32_t limit; // Remaining rows, or 0 for no limit.
+  int32_t target_bytes;
+  FDBStreamingMode mode;
+  int32_t iteration;
+  bool snapshot, reverse, packed;
+
+  // Ring buffer of batches which haven't been handed to javascript yet. The
+  // newest batch is still in flight if inFlight is set.
+  FDBFuture *batches[RANGE_ITERATOR_MAX_DEPTH];
+  uint32_t head, count, depth;
+  bool inFlight;
+
+  // Set when there are no more batches to request - we've reached the end of
+  // the range, hit the limit, had an error or been closed.
+  bool finished, closed;
+
+  // Set if we stopped because the transaction was disposed or reset.
+  bool cancelled;
+
+  // A call to next() waiting for the head batch to arrive.
+  napi_deferred waiting;
+};
+
+static bool setIterKey(uint8_t **key, int *len, const uint8_t *src, int srcLen) {
+  uint8_t *newKey = (uint8_t *)realloc(*key, srcLen > 0 ? srcLen : 1);
+  if (UNLIKELY(newKey == NULL)) return false;
+  memcpy(newKey, src, srcLen);
+  *key = newKey;
+  *len = srcLen;
+  return true;
+}
+
+static napi_status onIterBatch(napi_env env, FDBFuture *f, void *data);
+
+// Request the next batch if there's room for it.
+static napi_status iterFill(RangeIterator *it) {
+  if (it->finished || it->inFlight || it->count >= it->depth) return napi_ok;
+  if (UNLIKELY(it->tn->tr == NULL || it->tn->resets != it->resets)) {
+    it->finished = it->cancelled = true;
+    return napi_ok;
+  }
+
+  FDBFuture *f = fdb_transaction_get_range(it->tn->tr,
+    it->startKey, it->startLen, (fdb_bool_t)it->startOrEqual, it->startOffset,
+    it->endKey, it->endLen, (fdb_bool_t)it->endOrEqual, it->endOffset,
+    it->limit, it->target_bytes,
+    it->mode, ++it->iteration,
+    it->snapshot, it->reverse);
+
+  it->batches[(it->head + it->count) % RANGE_ITERATOR_MAX_DEPTH] = f;
+  it->count++;
+  it->inFlight = true;
+
+  // Don't let the iterator be garbage collected out from under the request.
+  NAPI_OK_OR_RETURN_STATUS(it->env, napi_reference_ref(it->env, it->self, NULL));
+  // This may call onIterBatch immediately if the result is already cached.
+  return futureWhenReady(it->env, f, onIterBatch, it);
+}
+
+// Hand the head batch to a waiting call to next(), if we can.
+static napi_status iterDeliver(napi_env env, RangeIterator *it) {
+  if (it->waiting == NULL) return napi_ok;
+
+  bool headReady = it->count > 1 || (it->count == 1 && !it->inFlight);
+  if (!headReady) {
+    if (it->count == 0 && it->finished) {
+      napi_deferred deferred = it->waiting;
+      it->waiting = NULL;
+      if (it->cancelled && !it->closed) {
+        // Don't make it look like the range ended early.
+        napi_value err;
+        NAPI_OK_OR_RETURN_STATUS(env, wrap_fdb_error(env, 1025, &err)); // transaction_cancelled
+        NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
+      } else {
+        // All done. Resolve with null.
+        napi_value nul;
+        NAPI_OK_OR_RETURN_STATUS(env, napi_get_null(env, &nul));
+        NAPI_OK_OR_RETURN_STATUS(env, napi_resolve_deferred(env, deferred, nul));
+      }
+    }
+    return napi_ok;
+  }
+
+  FDBFuture *f = it->batches[it->head];
+  it->head = (it->head + 1) % RANGE_ITERATOR_MAX_DEPTH;
+  it->count--;
+  napi_deferred deferred = it->waiting;
+  it->waiting = NULL;
+
+  fdb_error_t errcode = 0;
+  MaybeValue value = it->packed
+    ? getKeyValueListPacked(env, &f, &errcode)
+    : getKeyValueList(env, &f, &errcode);
+  if (f) fdb_future_destroy(f);
+
+  if (errcode != 0) {
+    napi_value err;
+    NAPI_OK_OR_RETURN_STATUS(env, wrap_fdb_error(env, errcode, &err));
+    NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
+  } else if (value.status != napi_ok) {
+    napi_value err;
+    NAPI_OK_OR_RETURN_STATUS(env, napi_get_and_clear_last_exception(env, &err));
+    NAPI_OK_OR_RETURN_STATUS(env, napi_reject_deferred(env, deferred, err));
+  } else {
+    NAPI_OK_OR_RETURN_STATUS(env, napi_resolve_deferred(env, deferred, value.value));
+  }
 
-  return futureToJS(env, f, args[12], getKeyValueList).value;
+  // We've made room for another batch.
+  return iterFill(it);
+}
+
+// Called on the main thread when the in flight batch arrives.
+static napi_status onIterBatch(napi_env env, FDBFuture *f, void *data) {
+  RangeIterator *it = (RangeIterator *)data;
+  it->inFlight = false;
+  NAPI_OK_OR_RETURN_STATUS(env, napi_reference_unref(env, it->self, NULL));
+
+  if (it->closed) {
+    // Nobody wants this batch anymore.
+    it->count--;
+    fdb_future_destroy(f);
+    return napi_ok;
+  }
+
+  const FDBKeyValue *kv;
+  int len;
+  fdb_bool_t more;
+  if (fdb_future_get_keyvalue_array(f, &kv, &len, &more) != 0) {
+    // The error is passed to javascript when it reads this batch.
+    it->finished = true;
+  } else {
+    if (len > 0) {
+      // Move the selector past the last key we've seen.
+      const FDBKeyValue *last = &kv[len - 1];
+      bool ok = it->reverse
+        ? setIterKey(&it->endKey, &it->endLen, last->key, last->key_length)
+        : setIterKey(&it->startKey, &it->startLen, last->key, last->key_length);
+      if (UNLIKELY(!ok)) return napi_generic_failure;
+      if (it->reverse) { it->endOrEqual = false; it->endOffset = 1; } // firstGreaterOrEqual
+      else { it->startOrEqual = true; it->startOffset = 1; } // firstGreaterThan
+    }
+
+    if (!more) it->finished = true;
+    if (it->limit) {
+      it->limit -= len;
+      if (it->limit <= 0) it->finished = true;
+    }
+  }
+
+  NAPI_OK_OR_RETURN_STATUS(env, iterFill(it));
+  return iterDeliver(env, it);
+}
+
+static void finalizeIterator(napi_env env, void* data, void* hint) {
+  RangeIterator *it = (RangeIterator *)data;
+  // Nothing can be in flight here, since that holds a strong reference.
+  for (uint32_t i = 0; i < it->count; i++) {
+    fdb_future_destroy(it->batches[(it->head + i) % RANGE_ITERATOR_MAX_DEPTH]);
+  }
+  free(it->startKey);
+  free(it->endKey);
+  napi_delete_reference(env, it->jsTn);
+  napi_delete_reference(env, it->self);
+  free(it);
+}
+
+// next() -> Promise<batch or null>. The batch has the same form as the result
+// of getRange or getRangePacked. Resolves to null when the range is done.
+static napi_value iterNext(napi_env env, napi_callback_info info) {
+  RangeIterator *it = (RangeIterator *)getWrapped(env, info);
+  if (UNLIKELY(it == NULL)) return NULL;
+
+  if (it->waiting != NULL) {
+    throw_if_not_ok(env, napi_throw_error(env, NULL, "Range iterator next() called again before the previous call resolved"));
+    return NULL;
+  }
+
+  napi_value promise;
+  TRY_V(napi_create_promise(env, &it->waiting, &promise));
+  TRY_V(iterDeliver(env, it));
+  return promise;
+}
+
+// close(). Stop reading and discard any buffered batches.
+static napi_value iterClose(napi_env env, napi_callback_info info) {
+  RangeIterator *it = (RangeIterator *)getWrapped(env, info);
+  if (UNLIKELY(it == NULL)) return NULL;
+
+  it->finished = it->closed = true;
+  // The in flight batch (if any) is cleaned up when it arrives.
+  uint32_t keep = it->inFlight ? 1 : 0;
+  while (it->count > keep) {
+    fdb_future_destroy(it->batches[it->head]);
+    it->head = (it->head + 1) % RANGE_ITERATOR_MAX_DEPTH;
+    it->count--;
+  }
+  TRY_V(iterDeliver(env, it));
+  return NULL;
+}
+
+// getRangeIterator(
+//   start, beginOrEqual, beginOffset,
+//   end, endOrEqual, endOffset,
+//   limit or 0, target_bytes or 0,
+//   streamingMode, snapshot, reverse,
+//   packed, depth
+// ) -> RangeIterator
+static napi_value getRangeIterator(napi_env env, napi_callback_info info) {
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
+  if (UNLIKELY(tr == NULL)) return NULL;
+
+  size_t argc = 13;
+  napi_value args[13];
+  napi_value jsTn;
+  TRY_V(napi_get_cb_info(env, info, &argc, args, &jsTn, NULL));
+
+  ScratchArena scratch;
+  StringParams start, end;
+  bool startOrEqual, endOrEqual, snapshot, reverse, packed;
+  int32_t startOffset, endOffset, limit, target_bytes, modeInt;
+  uint32_t depth;
+  TRY_V(toStringParams(env, args[0], &scratch, &start));
+  TRY_V(napi_get_value_bool(env, args[1], &startOrEqual));
+  TRY_V(napi_get_value_int32(env, args[2], &startOffset));
+  TRY_V(toStringParams(env, args[3], &scratch, &end));
+  TRY_V(napi_get_value_bool(env, args[4], &endOrEqual));
+  TRY_V(napi_get_value_int32(env, args[5], &endOffset));
+  TRY_V(napi_get_value_int32(env, args[6], &limit));
+  TRY_V(napi_get_value_int32(env, args[7], &target_bytes));
+  TRY_V(napi_get_value_int32(env, args[8], &modeInt));
+  TRY_V(napi_get_value_bool(env, args[9], &snapshot));
+  TRY_V(napi_get_value_bool(env, args[10], &reverse));
+  TRY_V(napi_get_value_bool(env, args[11], &packed));
+  TRY_V(napi_get_value_uint32(env, args[12], &depth));
+
+  RangeIterator *it = (RangeIterator *)calloc(1, sizeof(RangeIterator));
+  if (UNLIKELY(it == NULL
+      || !setIterKey(&it->startKey, &it->startLen, start.str, (int)start.len)
+      || !setIterKey(&it->endKey, &it->endLen, end.str, (int)end.len))) {
+    if (it) { free(it->startKey); free(it); }
+    throw_if_not_ok(env, napi_generic_failure);
+    return NULL;
+  }
+  it->tn = tn;
+  it->resets = tn->resets;
+  it->env = env;
+  it->startOrEqual = startOrEqual;
+  it->startOffset = startOffset;
+  it->endOrEqual = endOrEqual;
+  it->endOffset = endOffset;
+  it->limit = limit;
+  it->target_bytes = target_bytes;
+  it->mode = (FDBStreamingMode)modeInt;
+  it->snapshot = snapshot;
+  it->reverse = reverse;
+  it->packed = packed;
+  it->depth = depth < 1 ? 1 : depth > RANGE_ITERATOR_MAX_DEPTH ? RANGE_ITERATOR_MAX_DEPTH : depth;
+
+  napi_value ctor, obj;
+  TRY_V(napi_get_reference_value(env, getInstanceData(env)->iterator_cons, &ctor));
+  TRY_V(napi_new_instance(env, ctor, 0, NULL, &obj));
+  napi_status status = napi_wrap(env, obj, (void *)it, finalizeIterator, NULL, NULL);
+  if (status != napi_ok) {
+    free(it->startKey);
+    free(it->endKey);
+    free(it);
+    throw_if_not_ok(env, status);
+    return NULL;
+  }
+  // From here on the finalizer cleans up.
+  TRY_V(napi_create_reference(env, jsTn, 1, &it->jsTn));
+  TRY_V(napi_create_reference(env, obj, 0, &it->self));
+
+  TRY_V(iterFill(it));
+  return obj;
 }
 
 // clearRange(start, end). Clears range [start, end).
 static napi_value clearRange(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  TransactionWrap *tn;
+  FDBTransaction *tr = getTr(env, info, &tn);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 2);
 
+  ScratchArena scratch;
   StringParams start;
-  TRY_V(toStringParams(env, args[0], &start));
+  TRY_V(toStringParams(env, args[0], &scratch, &start));
   StringParams end;
-  TRY_V(toStringParams(env, args[1], &end));
+  TRY_V(toStringParams(env, args[1], &scratch, &end));
   fdb_transaction_clear_range(tr, start.str, start.len, end.str, end.len);
+  forgetAllPrefetched(tn);
+  trackMemory(env, tn, start.len + end.len + MUTATION_OVERHEAD_BYTES);
 
-  destroyStringParams(&start);
-  destroyStringParams(&end);
   return NULL;
 }
 
@@ -522,12 +1711,13 @@ static napi_value clearRange(napi_env env, napi_callback_info info) {
 // even after cancel has been called. The callback callback is *always* called
 // even if the owning txn is cancelled, conflicts, or is discarded.
 static napi_value watch(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 2);
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[0], &key));
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
 
   bool ignoreStandardErrors;
   TRY_V(napi_get_value_bool(env, args[1], &ignoreStandardErrors));
@@ -542,19 +1732,17 @@ static napi_value addConflictRange(napi_env env, napi_callback_info info, FDBCon
   // Its weird we're returning a value in these cases - we *always* return 0.
   // Doing it that way because it makes the macros simpler. Hopefully that gets
   // compiled out.
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 2);
 
+  ScratchArena scratch;
   StringParams start;
-  TRY_V(toStringParams(env, args[0], &start));
+  TRY_V(toStringParams(env, args[0], &scratch, &start));
   StringParams end;
-  TRY_V(toStringParams(env, args[1], &end));
+  TRY_V(toStringParams(env, args[1], &scratch, &end));
   fdb_error_t errorCode = fdb_transaction_add_conflict_range(tr, start.str, start.len, end.str, end.len, type);
 
-  destroyStringParams(&start);
-  destroyStringParams(&end);
-
   if (errorCode != 0) throw_fdb_error(env, errorCode);
   return NULL;
 }
@@ -571,7 +1759,7 @@ static napi_value addWriteConflictRange(napi_env env, napi_callback_info info) {
 
 
 static napi_value getReadVersion(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 1);
 
@@ -581,7 +1769,7 @@ static napi_value getReadVersion(napi_env env, napi_callback_info info) {
 
 // setReadVersion(version)
 static napi_value setReadVersion(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 1);
 
@@ -602,7 +1790,7 @@ static napi_value setReadVersion(napi_env env, napi_callback_info info) {
 
 
 static napi_value getCommittedVersion(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
 
   int64_t version;
@@ -613,7 +1801,7 @@ static napi_value getCommittedVersion(napi_env env, napi_callback_info info) {
 }
 
 static napi_value getVersionstamp(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 1);
 
@@ -623,15 +1811,15 @@ static napi_value getVersionstamp(napi_env env, napi_callback_info info) {
 
 // getAddressesForKey("somekey", [cb])
 static napi_value getAddressesForKey(napi_env env, napi_callback_info info) {
-  FDBTransaction *tr = (FDBTransaction *)getWrapped(env, info);
+  FDBTransaction *tr = getTr(env, info);
   if (UNLIKELY(tr == NULL)) return NULL;
   GET_ARGS(env, info, args, 2);
 
+  ScratchArena scratch;
   StringParams key;
-  TRY_V(toStringParams(env, args[0], &key));
+  TRY_V(toStringParams(env, args[0], &scratch, &key));
 
   FDBFuture *f = fdb_transaction_get_addresses_for_key(tr, key.str, key.len);
-  destroyStringParams(&key);
   return futureToJS(env, f, args[1], getStringArray).value;
 }
 
@@ -641,20 +1829,34 @@ napi_status initTransaction(napi_env env) {
   napi_property_descriptor desc[] = {
     FN_DEF(setOption),
     FN_DEF(commit),
+    FN_DEF(commitBlocking),
     FN_DEF(reset),
+    FN_DEF(dispose),
     FN_DEF(cancel),
     FN_DEF(onError),
+    FN_DEF(onErrorBlocking),
 
     FN_DEF(getApproximateSize),
+    FN_DEF(getEstimatedRangeSizeBytes),
 
     FN_DEF(get),
+    FN_DEF(getBlocking),
+    FN_DEF(getMaybeSync),
+    FN_DEF(getMany),
+    FN_DEF(prefetch),
+    FN_DEF(prefetchRange),
     FN_DEF(getKey),
     FN_DEF(set),
     FN_DEF(clear),
 
     FN_DEF(atomicOp),
+    FN_DEF(applyMutations),
 
     FN_DEF(getRange),
+    FN_DEF(getRangePacked),
+    FN_DEF(getRangeBlocking),
+    FN_DEF(getRangeIterator),
+    FN_DEF(getRangeIntoRing),
     FN_DEF(clearRange),
 
     FN_DEF(watch),
@@ -674,6 +1876,14 @@ napi_status initTransaction(napi_env env) {
   NAPI_OK_OR_RETURN_STATUS(env, napi_define_class(env, "Transaction", NAPI_AUTO_LENGTH,
     empty, NULL, sizeof(desc)/sizeof(desc[0]), desc, &constructor));
 
-  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &cons_ref));
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &getInstanceData(env)->transaction_cons));
+
+  napi_property_descriptor iterDesc[] = {
+    {"next", NULL, iterNext, NULL, NULL, NULL, napi_default, NULL},
+    {"close", NULL, iterClose, NULL, NULL, NULL, napi_default, NULL},
+  };
+  NAPI_OK_OR_RETURN_STATUS(env, napi_define_class(env, "RangeIterator", NAPI_AUTO_LENGTH,
+    empty, NULL, sizeof(iterDesc)/sizeof(iterDesc[0]), iterDesc, &constructor));
+  NAPI_OK_OR_RETURN_STATUS(env, napi_create_reference(env, constructor, 1, &getInstanceData(env)->iterator_cons));
   return napi_ok;
 }
\ No newline at end of file
@@ -31,6 +31,10 @@
 MaybeValue newTransaction(napi_env env, FDBTransaction *tr);
 napi_status initTransaction(napi_env env);
 
+// Values returned from get() which are at least this big are backed by the
+// future's memory instead of being copied. 0 disables zero-copy reads.
+void set_zero_copy_threshold(napi_env env, size_t bytes);
+
 
 // class Transaction: public node::ObjectWrap {
 //   public:
@@ -7,7 +7,9 @@ import {
   bufToNum,
   withEachDb,
 } from './util'
-import {MutationType, tuple, TupleItem, encoders, Watch, keySelector} from '../lib'
+import {keyMidpoint} from '../lib/splitPlanner'
+import {asBuf} from '../lib/util'
+import {MutationType, tuple, TupleItem, encoders, Watch, keySelector, setZeroCopyThreshold, Transaction, FDBError, getNativeStats, RangeRing, locality, StreamingMode} from '../lib'
 
 process.on('unhandledRejection', err => { throw err })
 
@@ -83,6 +85,225 @@ withEachDb(db => describe('key value functionality', () => {
     })
   })
 
+  it('only commits transactions which make changes', async () => {
+    let commits = 0
+    const countCommits = (tn: any) => {
+      const rawCommit = tn.rawCommit.bind(tn)
+      tn.rawCommit = () => { commits++; return rawCommit() }
+    }
+
+    await db.doTn(async tn => {
+      countCommits(tn)
+      await tn.get('xxx')
+      await tn.getRangeAll('a', 'z')
+      tn.addReadConflictKey('yyy')
+    })
+    assert.strictEqual(commits, 0)
+
+    await db.doTn(async tn => {
+      countCommits(tn)
+      await tn.get('xxx')
+      tn.set('xxx', 'hi')
+    })
+    assert.strictEqual(commits, 1)
+    assert.strictEqual((await db.get('xxx'))?.toString(), 'hi')
+  })
+
+  it('reuses finished transactions', async () => {
+    db.setTransactionPoolSize(4)
+    const before = db.getTransactionPoolStats()
+    await db.doTn(async tn => { tn.set('xxx', 'a') })
+    await db.doTn(async tn => { tn.set('xxx', 'b') })
+    const after = db.getTransactionPoolStats()
+    assert(after.reused > before.reused)
+    assert(after.size <= 4)
+    assert.strictEqual((await db.get('xxx'))?.toString(), 'b')
+
+    // Transactions with watches aren't reset, since that'd cancel the watch.
+    const released = db.getTransactionPoolStats().released
+    const w = await db.doTn(async tn => tn.watch('xxx'))
+    assert.strictEqual(db.getTransactionPoolStats().released, released)
+    w.cancel()
+    await w.promise
+
+    db.setTransactionPoolSize(0)
+    assert.strictEqual(db.getTransactionPoolStats().size, 0)
+    await db.doTn(async tn => { tn.set('xxx', 'c') })
+    assert.strictEqual(db.getTransactionPoolStats().size, 0)
+    db.setTransactionPoolSize(32)
+  })
+
+  it('disposes transactions when doTn finishes', async () => {
+    let leaked: Transaction<any, any, any, any> | null = null
+    await db.doTn(async tn => { leaked = tn; tn.set('xxx', 'a') })
+    assert.throws(() => leaked!.set('xxx', 'b'), /disposed/)
+
+    // Including when the body throws.
+    await assertRejects(db.doTn(async tn => { leaked = tn; throw Error('oops') }))
+    assert.throws(() => leaked!.set('xxx', 'b'), /disposed/)
+    assert.strictEqual((await db.get('xxx'))?.toString(), 'a')
+  })
+
+  it('does not let old transaction objects use a pooled transaction', async () => {
+    await db.doTn(async tn => {
+      for (let i = 0; i < 10; i++) tn.set('xxx' + i, 'a')
+    })
+
+    let scoped: Transaction<any, any, any, any> | null = null
+    let snap: Transaction<any, any, any, any> | null = null
+    let iter: AsyncGenerator<any> | null = null
+    await db.doTn(async tn => {
+      scoped = tn.at(db)
+      snap = tn.snapshot()
+      iter = tn.getRangeBatch('xxx', 'xxy', {readAhead: 4, limit: 2, streamingMode: StreamingMode.Exact})
+      await iter.next()
+    })
+
+    // The next doTn reuses the native transaction.
+    const reused = db.getTransactionPoolStats().reused
+    await db.doTn(async tn => {
+      assert.strictEqual(db.getTransactionPoolStats().reused, reused + 1)
+      assert.throws(() => scoped!.set('xxx0', 'b'), /disposed/)
+      assert.throws(() => snap!.get('xxx0'), /disposed/)
+      await assertRejects(iter!.next())
+      tn.set('xxx1', 'c')
+    })
+    assert.strictEqual((await db.get('xxx0'))?.toString(), 'a')
+    assert.strictEqual((await db.get('xxx1'))?.toString(), 'c')
+  })
+
+  it('can read at a cached read version', async () => {
+    await db.set('xxx', 'a')
+    db.setMaxReadVersionStaleness(5000)
+    try {
+      assert.strictEqual((await db.get('xxx'))?.toString(), 'a')
+      await db.set('xxx', 'b')
+      // Still reading at the version from before the write.
+      assert.strictEqual((await db.get('xxx'))?.toString(), 'a')
+
+      const stats = db.getReadVersionCacheStats()!
+      assert.strictEqual(stats.misses, 1)
+      assert.strictEqual(stats.hits, 2)
+      assert.strictEqual(stats.refreshes, 1)
+    } finally {
+      db.setMaxReadVersionStaleness(0)
+    }
+    assert.strictEqual(db.getReadVersionCacheStats(), null)
+    assert.strictEqual((await db.get('xxx'))?.toString(), 'b')
+  })
+
+  it('does not use the cached read version for priority or lock aware transactions', async () => {
+    await db.set('xxx', 'a')
+    db.setMaxReadVersionStaleness(5000)
+    try {
+      assert.strictEqual((await db.get('xxx'))?.toString(), 'a')
+      await db.set('xxx', 'b')
+      const value = await db.doTn(tn => tn.get('xxx'), {priority_system_immediate: true, lock_aware: true})
+      assert.strictEqual(value?.toString(), 'b')
+
+      const stats = db.getReadVersionCacheStats()!
+      assert.strictEqual(stats.hits + stats.misses, 2)
+    } finally {
+      db.setMaxReadVersionStaleness(0)
+    }
+  })
+
+  it('can share read versions between transactions started together', async () => {
+    await db.set('xxx', 'a')
+    db.setCoalesceReadVersions(true)
+    try {
+      const results = await Promise.all(new Array(10).fill(null).map(() => db.doTn(async tn => {
+        const value = await tn.get('xxx')
+        return [value?.toString(), (await tn.getReadVersion()).toString('hex')]
+      })))
+      // They all see the write, and all read at the same version.
+      assert.deepStrictEqual(new Set(results.map(([v]) => v)), new Set(['a']))
+      assert.strictEqual(new Set(results.map(([, rv]) => rv)).size, 1)
+
+      const stats = db.getReadVersionBatcherStats()!
+      assert.strictEqual(stats.requests, 10)
+      assert.strictEqual(stats.grvs, 1)
+      assert.strictEqual(stats.saved, 9)
+    } finally {
+      db.setCoalesceReadVersions(false)
+    }
+  })
+
+  it('only shares read versions between transactions with the same options', async () => {
+    db.setCoalesceReadVersions(true)
+    try {
+      await Promise.all([
+        db.doTn(tn => tn.get('xxx')),
+        db.doTn(tn => tn.get('xxx')),
+        db.doTn(tn => tn.get('xxx'), {lock_aware: true}),
+        db.doTn(tn => tn.get('xxx'), {lock_aware: true}),
+        db.doTn(tn => tn.get('xxx'), {priority_batch: true}),
+      ])
+      const stats = db.getReadVersionBatcherStats()!
+      assert.strictEqual(stats.requests, 5)
+      assert.strictEqual(stats.grvs, 3)
+    } finally {
+      db.setCoalesceReadVersions(false)
+    }
+  })
+
+  it('prefetches the previous attempt\'s reads when it retries', async () => {
+    let attempt = 0
+    let prefetched: string[] | null = null
+    await db.doTn(async tn => {
+      if (++attempt === 1) {
+        const raw = tn._tn
+        const prefetch = raw.prefetch.bind(raw)
+        raw.prefetch = (keys, isSnapshot) => {
+          prefetched = keys.map(k => k.toString())
+          prefetch(keys, isSnapshot)
+        }
+      }
+      await tn.get('a')
+      await tn.get('b')
+      if (attempt === 1) throw new FDBError('not_committed', 1020)
+    })
+    assert.strictEqual(attempt, 2)
+    assert.deepStrictEqual(prefetched, [testPrefix + 'a', testPrefix + 'b'])
+  })
+
+  it('prefetches ranges read with readAhead when it retries', async () => {
+    let attempt = 0
+    let prefetchedRanges = 0
+    await db.doTn(async tn => {
+      if (++attempt === 1) {
+        const raw = tn._tn
+        const prefetchRange = raw.prefetchRange.bind(raw)
+        raw.prefetchRange = (...args: Parameters<typeof raw.prefetchRange>) => {
+          prefetchedRanges++
+          prefetchRange(...args)
+        }
+      }
+      for await (const _batch of tn.getRangeBatch('a', 'z', {readAhead: 2})) {}
+      if (attempt === 1) throw new FDBError('not_committed', 1020)
+    })
+    assert.strictEqual(attempt, 2)
+    assert.strictEqual(prefetchedRanges, 1)
+  })
+
+  it('does not prefetch reads for scans which carry on from a cursor', async () => {
+    let attempt = 0
+    let prefetches = 0
+    await db.doTn(async tn => {
+      tn._skipReadReplay()
+      if (++attempt === 1) {
+        const raw = tn._tn
+        raw.prefetch = () => { prefetches++ }
+        raw.prefetchRange = () => { prefetches++ }
+      }
+      await tn.get('a')
+      await tn.getRangeAll('a', 'z')
+      if (attempt === 1) throw new FDBError('not_committed', 1020)
+    })
+    assert.strictEqual(attempt, 2)
+    assert.strictEqual(prefetches, 0)
+  })
+
   it('obeys transaction options', async function() {
     // We can't test all the options, but we can test at least one.
     await db.doTransaction(async tn => {
@@ -397,6 +618,366 @@ withEachDb(db => describe('key value functionality', () => {
     
   })
 
+  describe('zero-copy reads', () => {
+    afterEach(() => setZeroCopyThreshold(0))
+
+    it('returns the same values with zero-copy reads enabled', async () => {
+      const small = Buffer.from('hi')
+      const big = Buffer.alloc(10000, 'x')
+      await db.doTn(async tn => {
+        tn.set('small', small)
+        tn.set('big', big)
+      })
+
+      setZeroCopyThreshold(1000)
+      assert.deepStrictEqual(await db.get('small'), small)
+      assert.deepStrictEqual(await db.get('big'), big)
+      assert.strictEqual(await db.get('missing'), undefined)
+    })
+  })
+
+  describe('getMany', () => {
+    it('returns the values of all the keys in order', async () => {
+      await db.doTn(async tn => {
+        tn.set('a', 'aa')
+        tn.set('c', 'cc')
+        // This also checks getMany reads its writes.
+        const vals = await tn.getMany(['a', 'b', Buffer.from('c'), 'a'])
+        assert.deepStrictEqual(vals.map(v => v?.toString()), ['aa', undefined, 'cc', 'aa'])
+      })
+      assert.deepStrictEqual(await db.getMany([]), [])
+    })
+
+    it('decodes values through the subspace', async () => {
+      const _db = db.at(null, tuple, encoders.json)
+      await _db.set(['x', 1], {some: 'json'})
+      assert.deepStrictEqual(await _db.getMany([['x', 1], ['x', 2]]), [{some: 'json'}, undefined])
+    })
+  })
+
+  it('batches concurrent reads with a batched reader', async () => {
+    await db.set('a', 'aa')
+    await db.set('b', 'bb')
+    const reader = db.batchedReader({maxBatchSize: 3})
+    const vals = await Promise.all(['a', 'b', 'c', 'a', 'b'].map(k => reader.get(k)))
+    assert.deepStrictEqual(vals.map(v => v?.toString()), ['aa', 'bb', undefined, 'aa', 'bb'])
+    assert.deepStrictEqual(reader.getStats(), {gets: 5, batches: 2})
+
+    const timed = db.batchedReader({maxWaitMs: 5})
+    const first = timed.get('a')
+    await new Promise(resolve => setImmediate(resolve))
+    const second = timed.get('b')
+    assert.deepStrictEqual((await Promise.all([first, second])).map(v => v?.toString()), ['aa', 'bb'])
+    assert.strictEqual(timed.getStats().batches, 1)
+  })
+
+  describe('reads which are ready immediately', () => {
+    it('returns cached values synchronously from getMaybeSync', async () => {
+      await db.set('b', 'bb')
+      await db.doTn(async tn => {
+        tn.set('a', 'aa')
+        const before = getNativeStats().readyFastPath
+        assert.strictEqual(tn.getMaybeSync('a')?.toString(), 'aa')
+        assert.strictEqual(getNativeStats().readyFastPath, before + 1)
+
+        const b = tn.getMaybeSync('b')
+        assert(b instanceof Promise)
+        assert.strictEqual((await b)?.toString(), 'bb')
+
+        tn.clear('a')
+        assert.strictEqual(tn.getMaybeSync('a'), undefined)
+      })
+    })
+
+    it('resolves promises for ready futures without the completion queue', async () => {
+      const before = getNativeStats().readyFastPath
+      await db.doTn(async tn => {
+        tn.set('a', 'aa')
+        assert.strictEqual((await tn.get('a'))?.toString(), 'aa')
+      })
+      assert(getNativeStats().readyFastPath > before)
+    })
+  })
+
+  describe('prefetch', () => {
+    it('returns prefetched values from get', async () => {
+      await db.set('a', 'aa')
+      await db.set('c', 'cc')
+      const vals = await db.doTn(async tn => {
+        tn.prefetch(['a', 'b', 'c'])
+        tn.prefetchRange('a', 'z')
+        return [await tn.get('a'), await tn.get('b'), ...(await tn.getMany(['c', 'a']))]
+      })
+      assert.deepStrictEqual(vals.map(v => v?.toString()), ['aa', undefined, 'cc', 'aa'])
+    })
+
+    it('sees writes made after the prefetch', async () => {
+      await db.set('a', 'aa')
+      const val = await db.doTn(async tn => {
+        tn.snapshot().prefetch(['a'])
+        tn.set('a', 'new')
+        return await tn.get('a')
+      })
+      assert.strictEqual(val?.toString(), 'new')
+    })
+
+    it('adds read conflicts when a snapshot prefetch is read normally', async () => {
+      await db.set('a', 'aa')
+      const tn1 = db.rawCreateTransaction()
+      tn1.snapshot().prefetch(['a'])
+      assert.strictEqual((await tn1.get('a'))?.toString(), 'aa')
+      tn1.set('b', 'x')
+
+      await db.set('a', 'changed')
+      await assertRejects(tn1.rawCommit())
+    })
+  })
+
+  describe('mutation batches', () => {
+    it('applies sets, clears and atomic ops in one call', async () => {
+      await db.set('cleared', 'x')
+      await db.doTn(async tn => {
+        const batch = tn.mutationBatch()
+        batch.set('a', 'hi')
+        batch.set(Buffer.from('b'), Buffer.alloc(10000, 'y'))
+        batch.clear('cleared')
+        batch.add('counter', numToBuf(5))
+        batch.add('counter', numToBuf(10))
+        assert.strictEqual(batch.count, 5)
+        tn.applyMutations(batch)
+      })
+
+      assert.strictEqual((await db.get('a'))?.toString(), 'hi')
+      assert.deepStrictEqual(await db.get('b'), Buffer.alloc(10000, 'y'))
+      assert.strictEqual(await db.get('cleared'), undefined)
+      assert.strictEqual(bufToNum((await db.get('counter'))!), 15)
+    })
+
+    it('encodes keys and values through the subspace', async () => {
+      const _db = db.at(null, tuple, encoders.json)
+      await _db.doTn(async tn => {
+        tn.applyMutations(tn.mutationBatch().set(['x', 1], {some: 'json'}))
+      })
+      assert.deepStrictEqual(await _db.get(['x', 1]), {some: 'json'})
+    })
+
+    it('rejects malformed batches without applying any of them', async () => {
+      const good = db.mutationBatch().set('k', 'v').toBuffer()
+      await db.doTn(async tn => {
+        assert.throws(() => tn.applyMutations(good.subarray(0, good.length - 1)))
+      })
+      assert.strictEqual(await db.get('k'), undefined)
+    })
+
+    it('rejects batches with unknown op codes', async () => {
+      const setBytes = db.mutationBatch().set('k', 'v').byteLength
+      const batch = Buffer.from(db.mutationBatch().set('k', 'v').add('c', numToBuf(1)).toBuffer())
+      // Change the add's op code. 3 isn't an atomic op type.
+      batch[setBytes] = 3
+      await db.doTn(async tn => {
+        assert.throws(() => tn.applyMutations(batch), /Invalid packed mutation list/)
+      })
+      assert.strictEqual(await db.get('k'), undefined)
+    })
+  })
+
+  describe('group commit writer', () => {
+    it('commits concurrent writes together', async () => {
+      await db.set('c', Buffer.from([1, 0, 0, 0]))
+      const writer = db.groupCommitWriter()
+      await Promise.all([
+        writer.set('a', 'aa'),
+        writer.set('b', 'bb'),
+        writer.add('c', Buffer.from([2, 0, 0, 0])),
+        writer.clear('b'),
+      ])
+      assert.strictEqual((await db.get('a'))?.toString(), 'aa')
+      assert.strictEqual(await db.get('b'), undefined)
+      assert.deepStrictEqual(await db.get('c'), Buffer.from([3, 0, 0, 0]))
+      assert.deepStrictEqual(writer.getStats(), {writes: 4, commits: 1, splits: 0})
+    })
+
+    it('only fails the writes which are invalid', async () => {
+      const writer = db.groupCommitWriter({maxBatchBytes: 1000000})
+      const results = await Promise.all([
+        writer.set('a', 'aa'),
+        writer.set('b', Buffer.alloc(200000)), // Over the value size limit.
+        writer.set('c', 'cc'),
+      ].map(p => p.then(() => 'ok', () => 'failed')))
+      assert.deepStrictEqual(results, ['ok', 'failed', 'ok'])
+      assert.strictEqual((await db.get('a'))?.toString(), 'aa')
+      assert.strictEqual(await db.get('b'), undefined)
+      assert.strictEqual((await db.get('c'))?.toString(), 'cc')
+      assert(writer.getStats().splits > 0)
+    })
+
+    it('does not retry writes which may have committed', async () => {
+      const writer = db.groupCommitWriter()
+      const doTn = db.doTn
+      let attempts = 0
+      db.doTn = (() => { attempts++; return Promise.reject(new FDBError('commit_unknown_result', 1021)) }) as any
+      try {
+        const results = await Promise.all([writer.add('c', numToBuf(1)), writer.add('c', numToBuf(2))]
+          .map(p => p.then(() => 'ok', e => e.code)))
+        assert.deepStrictEqual(results, [1021, 1021])
+      } finally {
+        db.doTn = doTn
+      }
+      assert.strictEqual(attempts, 1)
+      assert.strictEqual(writer.getStats().splits, 0)
+    })
+  })
+
+  describe('range rings', () => {
+    it('only lets one scan write to a ring at a time', async () => {
+      await db.set('k1', 'v')
+      const ring = new RangeRing(1000000)
+      await db.doTn(async tn => {
+        const first = tn.getRangeIntoRing(ring, 'k')
+        await tn.getRangeIntoRing(ring, 'k').then(
+          () => Promise.reject(Error('should have thrown')),
+          e => assert(/already being written/.test(e.message)))
+        assert.strictEqual(await first, 1)
+        // Once the first scan has finished, another can follow it.
+        assert.strictEqual(await tn.getRangeIntoRing(ring, 'k'), 1)
+      })
+    })
+
+    it('scans a range into a ring while it is being read', async () => {
+      await db.doTn(async tn => {
+        for (let i = 0; i < 300; i++) tn.set('k' + `${i}`.padStart(3, '0'), Buffer.alloc(1000, i))
+      })
+
+      // Small enough that the scan has to wait for the reader.
+      const ring = new RangeRing(240000)
+      const seen: string[] = []
+      const read = (async () => {
+        while (true) {
+          const batch = ring.tryRead(db)
+          if (batch === null) break
+          if (batch === undefined) await new Promise(resolve => setImmediate(resolve))
+          else for (const [k, v] of batch) {
+            assert.strictEqual(v.length, 1000)
+            seen.push(k.toString())
+          }
+        }
+      })()
+
+      const [rows] = await Promise.all([
+        db.scanIntoRing(ring, 'k', undefined, {batchBytes: 1000, batchRows: 10}),
+        read
+      ])
+      assert.strictEqual(rows, 300)
+      assert.deepStrictEqual(seen, new Array(300).fill(0).map((_, i) => 'k' + `${i}`.padStart(3, '0')))
+    })
+
+    it('fails readers if the scan fails', async () => {
+      const ring = new RangeRing(240000)
+      ring.fail(new FDBError('transaction_too_old', 1007))
+      assert.throws(() => ring.read(), (e: any) => e.code === 1007)
+      assert.throws(() => new RangeRing(1000)._maxChunkBytes(1000, 10), /too small/)
+    })
+  })
+
+  describe('parallel scan', () => {
+    it('finds shard boundaries', async () => {
+      const keys = await locality.getBoundaryKeys(db, Buffer.from(''), Buffer.from('\xff', 'latin1'))
+      // The first shard always starts at the beginning of the keyspace.
+      assert.deepStrictEqual(keys[0], Buffer.from(''))
+      for (let i = 1; i < keys.length; i++) assert(Buffer.compare(keys[i-1], keys[i]) < 0)
+    })
+
+    it('reads shard boundaries at a lock aware read version', async () => {
+      db.setMaxReadVersionStaleness(5000)
+      db.setCoalesceReadVersions(true)
+      try {
+        const keys = await locality.getBoundaryKeys(db, Buffer.from(''), Buffer.from('\xff', 'latin1'))
+        assert.deepStrictEqual(keys[0], Buffer.from(''))
+        // It doesn't share a version with transactions which aren't lock aware.
+        const cacheStats = db.getReadVersionCacheStats()!
+        assert.strictEqual(cacheStats.hits + cacheStats.misses, 0)
+        assert.strictEqual(db.getReadVersionBatcherStats()!.requests, 1)
+      } finally {
+        db.setMaxReadVersionStaleness(0)
+        db.setCoalesceReadVersions(false)
+      }
+    })
+
+    it('yields the whole range in order', async () => {
+      await db.doTn(async tn => {
+        for (let i = 0; i < 500; i++) tn.set('k' + `${i}`.padStart(3, '0'), `${i}`)
+      })
+
+      const expected = await db.getRangeAll('k')
+      const result: [Buffer, Buffer][] = []
+      for await (const batch of db.parallelScan('k', undefined, {concurrency: 2, bufferBatches: 1})) {
+        result.push(...batch)
+      }
+      assert.deepStrictEqual(result, expected)
+
+      // Stopping early is fine too.
+      for await (const batch of db.parallelScan('k')) {
+        assert(batch.length > 0)
+        break
+      }
+    })
+
+    it('fails consistent scans which outlive their read version', async function() {
+      this.timeout(20000)
+      this.slow(10000)
+      await db.doTn(async tn => {
+        for (let i = 0; i < 1000; i++) tn.set('k' + `${i}`.padStart(4, '0'), Buffer.alloc(1000))
+      })
+
+      let err: any = null
+      try {
+        for await (const _batch of db.parallelScan('k', undefined, {bufferBatches: 1, consistent: true})) {
+          // Hold the scan up past the 5 second transaction lifetime.
+          await new Promise(resolve => setTimeout(resolve, 6000))
+        }
+      } catch (e) {
+        err = e
+      }
+      assert(err instanceof FDBError)
+      assert.strictEqual(err.code, 1007)
+    })
+  })
+
+  describe('range size estimates', () => {
+    it('estimates the size of a range', async () => {
+      await db.doTn(async tn => {
+        for (let i = 0; i < 100; i++) tn.set('k' + `${i}`.padStart(3, '0'), Buffer.alloc(1000))
+      })
+      const size = await db.getEstimatedRangeSizeBytes('k')
+      assert(typeof size === 'number' && size >= 0)
+      assert.strictEqual(await db.doTn(tn => tn.getEstimatedRangeSizeBytes('x', 'y')), 0)
+    })
+
+    it('finds keys half way between other keys', () => {
+      assert.deepStrictEqual(keyMidpoint(Buffer.from('a'), Buffer.from('c')), Buffer.from('b'))
+      assert.deepStrictEqual(keyMidpoint(Buffer.from('a'), Buffer.from('b')), Buffer.from('a\x80', 'latin1'))
+      assert.strictEqual(keyMidpoint(Buffer.from('a'), Buffer.from('a\x00')), null)
+    })
+
+    it('plans splits which cover the range in order', async () => {
+      await db.doTn(async tn => {
+        for (let i = 0; i < 500; i++) tn.set('k' + `${i}`.padStart(3, '0'), Buffer.alloc(1000))
+      })
+      const range = db.subspace.packRange('k')
+      const splits = await db.planRangeSplits('k', undefined, {chunkBytes: 50000})
+      assert.deepStrictEqual(splits[0].begin, asBuf(range.begin))
+      assert.deepStrictEqual(splits[splits.length - 1].end, asBuf(range.end))
+      for (let i = 1; i < splits.length; i++) {
+        assert.deepStrictEqual(splits[i].begin, splits[i-1].end)
+        assert(Buffer.compare(splits[i].begin, splits[i].end) < 0)
+      }
+
+      // An empty range is one chunk.
+      const empty = db.subspace.packRange('x')
+      assert.deepStrictEqual(await db.planRangeSplits('x'), [{begin: asBuf(empty.begin), end: asBuf(empty.end), bytes: 0}])
+    })
+  })
+
   describe('regression', () => {
     it('does not trim off the end of a string', async () => {
       // https://github.com/josephg/node-foundationdb/issues/40
@@ -65,6 +65,47 @@ withEachDb(db => describe('key value functionality', () => {
     })
   })
 
+  it('returns all values through packed getRangeBatch', async () => {
+    const _db = await prefill()
+    await _db.doTransaction(async tn => {
+      let i = 0
+      for await (const batch of tn.getRangeBatch(0, 1000, {packed: true})) {
+        for (let k = 0; k < batch.length; k++) {
+          assert.strictEqual(batch.key(k), i)
+          assert.strictEqual(batch.value(k), i)
+          i++
+        }
+      }
+      assert.strictEqual(i, 100)
+
+      // And the same thing in reverse, through getRangeAll.
+      const all = await tn.getRangeAll(0, 1000, {packed: true, reverse: true, limit: 10})
+      assert.deepStrictEqual(all.map(([k]) => k), [99, 98, 97, 96, 95, 94, 93, 92, 91, 90])
+    })
+  })
+
+  it('returns all values through getRange with read-ahead', async () => {
+    const _db = await prefill()
+    await _db.doTransaction(async tn => {
+      const opts = {readAhead: 4, streamingMode: fdb.StreamingMode.Small}
+      const keys: number[] = []
+      for await (const [key, val] of tn.getRange(0, 1000, opts)) {
+        assert.strictEqual(key, val)
+        keys.push(key)
+      }
+      assert.deepStrictEqual(keys, new Array(100).fill(0).map((_, i) => i))
+
+      const reversed: number[] = []
+      for await (const batch of tn.getRangeBatch(0, 1000, {...opts, reverse: true, limit: 30, packed: true})) {
+        for (let k = 0; k < batch.length; k++) reversed.push(batch.key(k))
+      }
+      assert.deepStrictEqual(reversed, new Array(30).fill(0).map((_, i) => 99 - i))
+
+      // Bailing out early closes the iterator.
+      for await (const _ of tn.getRange(0, 1000, opts)) break
+    })
+  })
+
   it('supports raw string ranges against the root database', async () => {
     // Regression - https://github.com/josephg/node-foundationdb/pull/39
     
@@ -3,6 +3,9 @@ import assert = require('assert')
 import * as fdb from '../lib'
 import {testApiVersion} from './util'
 import mod from '../lib/native'
+import path = require('path')
+import {Worker} from 'worker_threads'
+import {execFile} from 'child_process'
 
 fdb.setAPIVersion(testApiVersion)
 
@@ -28,6 +31,115 @@ describe('state tests', () => {
 
   })
 
+  it('counts resolved futures in the native stats', async () => {
+    const db = fdb.open()
+    const before = fdb.getNativeStats().completions
+    await Promise.all(new Array(10).fill(0).map(() => db.get('x')))
+    const stats = fdb.getNativeStats()
+    db.close()
+
+    assert(stats.completions > before)
+    assert(stats.completionBatches > 0)
+    assert.strictEqual(stats.outstandingFutures, 0)
+  })
+
+  it('runs transactions from worker threads alongside the main thread', async function() {
+    this.timeout(20000)
+    // Each worker loads its own copy of the module, sharing the network thread.
+    const code = `
+      require('ts-node/register')
+      const {workerData, parentPort} = require('worker_threads')
+      const fdb = require(workerData.lib)
+      fdb.setAPIVersion(workerData.apiVersion)
+      const db = fdb.open().at(workerData.prefix)
+      ;(async () => {
+        await db.set('k', 'worker ' + workerData.id)
+        const val = await db.get('k')
+        await db.clearRangeStartsWith('')
+        db.close()
+        parentPort.postMessage(val.toString())
+      })()
+    `
+    const db = fdb.open()
+    const results = await Promise.all([0, 1, 2].map(id => new Promise((resolve, reject) => {
+      const w = new Worker(code, {eval: true, workerData: {
+        id, apiVersion: testApiVersion, lib: path.resolve(__dirname, '../lib'), prefix: `__test_data__/worker${id}/`
+      }})
+      w.on('message', resolve)
+      w.on('error', reject)
+    })))
+    // The main thread's connection still works after the workers have exited.
+    await db.get('x')
+    db.close()
+    assert.deepStrictEqual(results, ['worker 0', 'worker 1', 'worker 2'])
+  })
+
+  it('keeps the network running for workers started one after another', async function() {
+    this.timeout(20000)
+    // This needs a fresh process where the main thread never opens a
+    // database, so the first worker to exit is the last env using the network.
+    const worker = `
+      require('ts-node/register')
+      const {workerData, parentPort} = require('worker_threads')
+      const fdb = require(workerData.lib)
+      fdb.setAPIVersion(workerData.apiVersion)
+      const db = fdb.open()
+      db.get('x').then(() => { db.close(); parentPort.postMessage('ok') })
+    `
+    const main = `
+      const {Worker} = require('worker_threads')
+      const run = () => new Promise((resolve, reject) => {
+        const w = new Worker(${JSON.stringify(worker)}, {eval: true, workerData: {
+          apiVersion: ${testApiVersion}, lib: ${JSON.stringify(path.resolve(__dirname, '../lib'))}
+        }})
+        w.on('message', resolve)
+        w.on('error', reject)
+        w.on('exit', () => reject(Error('worker exited without a result')))
+      })
+      run().then(run).then(() => process.exit(0), e => { console.error(e); process.exit(1) })
+    `
+    await new Promise<void>((resolve, reject) => {
+      execFile(process.execPath, ['-e', main], {timeout: 15000}, (err, stdout, stderr) => {
+        if (err) reject(Error(stderr || err.message))
+        else resolve()
+      })
+    })
+  })
+
+  it('only allows blocking calls from worker threads', async function() {
+    this.timeout(20000)
+    const db = fdb.open()
+    assert.throws(() => db.doTnBlocking(tn => tn.getBlocking('x')), /worker threads/)
+    db.close()
+
+    const code = `
+      require('ts-node/register')
+      const {workerData, parentPort} = require('worker_threads')
+      const fdb = require(workerData.lib)
+      fdb.setAPIVersion(workerData.apiVersion)
+      const db = fdb.open().at(workerData.prefix)
+      db.doTnBlocking(tn => {
+        tn.set('a', 'aa')
+        tn.set('b', 'bb')
+      })
+      const result = db.doTnBlocking(tn => [
+        tn.getBlocking('a').toString(),
+        tn.getRangeBlocking('a', 'z').map(([k, v]) => v.toString()),
+      ])
+      db.doTnBlocking(tn => tn.clearRange('', '\\xff'))
+      db.close()
+      parentPort.postMessage(result)
+    `
+    const result = await new Promise((resolve, reject) => {
+      const w = new Worker(code, {eval: true, workerData: {
+        apiVersion: testApiVersion, lib: path.resolve(__dirname, '../lib'), prefix: '__test_data__/blocking/'
+      }})
+      w.on('message', resolve)
+      w.on('error', reject)
+    })
+    assert.deepStrictEqual(result, ['aa', ['aa', 'bb']])
+  })
+
   it('does nothing if the native module has setAPIVersion called again', () => {
     mod.setAPIVersion(testApiVersion)
     mod.setAPIVersionImpl(testApiVersion, testApiVersion)